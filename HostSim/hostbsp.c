@@ -0,0 +1,113 @@
+// hostbsp.c
+// Runs on Linux
+// Stand-ins for the BoosterPack and TExaS functions used by the
+// Lab 3 and Lab 4 test mains, for the host simulation in hostsim.c.
+// The LCD, LEDs and buzzer do nothing, the buttons are never
+// pressed and the sensors return fixed readings, so the threads
+// run the same code paths every time. The clock and timer
+// functions of BSP.c are in hostsim.c.
+
+#include <stdint.h>
+
+//------------buttons, not pressed------------
+void BSP_Button1_Init(void){
+}
+uint8_t BSP_Button1_Input(void){
+  return 0x02;              // PD6 high means not pressed
+}
+void BSP_Button2_Init(void){
+}
+uint8_t BSP_Button2_Input(void){
+  return 0x02;
+}
+
+//------------outputs, ignored------------
+void BSP_RGB_Init(uint16_t red, uint16_t green, uint16_t blue){
+}
+void BSP_RGB_Set(uint16_t red, uint16_t green, uint16_t blue){
+}
+void BSP_Buzzer_Init(uint16_t duty){
+}
+void BSP_Buzzer_Set(uint16_t duty){
+}
+
+//------------sensors, fixed readings------------
+void BSP_Accelerometer_Init(void){
+}
+void BSP_Accelerometer_Input(uint16_t *x, uint16_t *y, uint16_t *z){
+  *x = 512; *y = 512; *z = 800;   // lying still
+}
+void BSP_Microphone_Init(void){
+}
+uint32_t MicCount;
+void BSP_Microphone_Input(uint16_t *mic){
+  MicCount = MicCount+1;
+  *mic = (MicCount&1) ? 500 : 524; // a quiet square wave, RMS 12
+}
+void BSP_LightSensor_Init(void){
+}
+void BSP_LightSensor_Start(void){
+}
+int BSP_LightSensor_End(uint32_t *light){
+  *light = 20000;           // 200.00 lux
+  return 1;                 // always done
+}
+void BSP_TempSensor_Init(void){
+}
+void BSP_TempSensor_Start(void){
+}
+int BSP_TempSensor_End(int32_t *sensorV, int32_t *localT){
+  *sensorV = 0;
+  *localT = 250000;         // 25.0000 C
+  return 1;
+}
+
+//------------LCD, ignored------------
+void BSP_LCD_Init(void){
+}
+void BSP_LCD_FillScreen(uint16_t color){
+}
+uint16_t BSP_LCD_Color565(uint8_t r, uint8_t g, uint8_t b){
+  return ((b&0xF8)<<8)|((g&0xFC)<<3)|(r>>3);
+}
+void BSP_LCD_DrawBitmap(int16_t x, int16_t y, const uint16_t *image, int16_t w, int16_t h){
+}
+uint32_t BSP_LCD_DrawString(uint16_t x, uint16_t y, char *pt, int16_t textColor){
+  uint32_t n = 0;
+  while(pt[n]){
+    n++;
+  }
+  return n;
+}
+void BSP_LCD_SetCursor(uint32_t newX, uint32_t newY){
+}
+void BSP_LCD_OutUDec4(uint32_t n, int16_t textColor){
+}
+void BSP_LCD_OutUFix2_1(uint32_t n, int16_t textColor){
+}
+void BSP_LCD_Drawaxes(uint16_t axisColor, uint16_t bgColor, char *xLabel,
+  char *yLabel1, uint16_t label1Color, char *yLabel2, uint16_t label2Color,
+  int32_t ymax, int32_t ymin){
+}
+void BSP_LCD_PlotPoint(int32_t data1, uint16_t color1){
+}
+void BSP_LCD_PlotIncrement(void){
+}
+
+//------------TExaS, no logic analyzer or grader------------
+void TExaS_Init(int mode, uint32_t edXcode){
+}
+void TExaS_Task0(void){
+}
+void TExaS_Task1(void){
+}
+void TExaS_Task2(void){
+}
+void TExaS_Task3(void){
+}
+void TExaS_Task4(void){
+}
+void TExaS_Task5(void){
+}
+void TExaS_Task6(void){
+}
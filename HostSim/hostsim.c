@@ -0,0 +1,910 @@
+// hostsim.c
+// Runs on Linux x86-64
+// Host simulation of the parts of the TM4C123 the Lab 3 and Lab 4
+// kernels use, so os.c and the test mains in Lab3.c/Lab4.c run
+// unchanged on a PC for benchmarking and testing.
+// - Each thread runs on its own ucontext with a host stack; the
+//   context switch of osasm.s is a swapcontext.
+// - A simulated 80 MHz clock drives SysTick and the wide timers of
+//   BSP_PeriodicTask_Init/InitB/InitC, and in Lab 4 the one-shot
+//   Wide Timer 1A os.c starts for server budgets, which runs while
+//   its TAEN bit is set, and the 64-bit Wide Timer 2 time base with
+//   its match interrupt. Wide Timer 3B is the software interrupt
+//   os.c pends with NVIC_SW_TRIG_R. A host interval timer signal
+//   advances it by SLICEUS us and acts as the interrupt, so busy
+//   threads are preempted. WaitForInterrupt skips ahead to the next
+//   timer event, so idle time costs nothing.
+// - PRIMASK, interrupt priorities, SysTick and PendSV pending bits
+//   (INTCTRL) follow the Cortex-M rules closely enough for the OS.
+// - The peripheral and private peripheral address ranges are mapped
+//   as plain memory, so register accesses in os.c just work; the
+//   simulator keeps STCURRENT, TAV, RIS and DWTCYCCNT up to date.
+//   The page with SysTick and INTCTRL is read only, so a write to it
+//   faults and is single stepped, and a PendSV set by a thread is
+//   taken right after the store, as on the real processor.
+// - Tests can touch button1 (PD6) every so many ms; each touch is
+//   BOUNCES falling edges BOUNCEUS apart, taken by GPIOPortD_Handler
+//   at its NVIC priority while PD6 is armed, and latched in RIS
+//   while it is not. Writes to GPIO_PORTD_ICR_R apply at the next edge.
+// At the end it prints context switches per second and the latency
+// from a timer interrupt to the switch it caused (Lab 4 only, the
+// round robin Lab 3 scheduler waits for the next time slice), in
+// simulated time. SimNow moves in SLICEUS steps, so both ends are
+// timestamped with the host time since the step began; the latency
+// is the host's time to run the ISR, the scheduler and the switch,
+// plus any delay from masked sections and other interrupts.
+// Tests that keep an error counter (TimerErrors, SleepErrors, ...)
+// print it, and the exit status is 1 if it is not 0. Built with
+// -DEDF=1 it also prints the EDF deadline misses, and the exit
+// status is 1 if a test such as edftest that must not miss any did.
+//
+// Build the Lab 4 kernel (LAB=3 and ../Lab3_4C123 for Lab 3):
+//   gcc -std=gnu99 -O2 -no-pie -Wall -include hostsim.h -I../inc -DLAB=4
+//       ../Lab4_Fitness_4C123/Lab4.c ../Lab4_Fitness_4C123/os.c
+//       ../inc/Profile.c hostsim.c hostbsp.c -o sim4
+// -no-pie keeps code addresses below 4 GB, because os.c stores the
+// thread's start address in a 32-bit stack word.
+// Run:  ./sim4 [test] [simulated seconds], e.g. ./sim4 step2 10
+//       ./sim4 list shows the test mains
+
+#undef main
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include "CortexM.h"
+#include "tm4c123gh6pm.h"
+
+#ifndef LAB
+#define LAB 4
+#endif
+
+#define BUSFREQ     80000000  // simulated bus clock, as BSP_Clock_InitFastest
+#define SLICEUS     50        // simulated us per host timer signal
+#define THREADLEVEL 256       // CurrentPriority while a thread runs
+#define NUMCTX      32        // maximum number of threads
+#define CTXSTACK    (256*1024)// host stack bytes per thread
+#define PPB         0xE0000000// private peripheral bus window
+#define PPBSIZE     0x00010000
+#define SCB         0xE000E000// page with SysTick, NVIC and INTCTRL
+#define PAGESIZE    0x1000
+#define EFLAGS_TF   0x100     // x86 trap flag, single step
+
+// in os.c
+extern void *RunPt;           // the TCB starts with the saved stack pointer
+void Scheduler(void);
+#if LAB == 4
+void SysTick_Handler(void);
+void GPIOPortD_Handler(void);
+void WideTimer1A_Handler(void);
+void WideTimer2A_Handler(void);
+void WideTimer3B_Handler(void);
+extern uint32_t KernelBasePri;
+uint32_t OS_CPULoad(void);
+uint32_t OS_DeadlineMisses(void);
+extern void *DeadlineHeap[] __attribute__((weak)); // only when os.c is built with EDF 1
+#endif
+
+// ******** simulated interrupt sources ************
+struct source {
+  const char *name;
+  void (*isr)(void);
+  uint32_t priority;          // 0 highest, 7 lowest
+  uint32_t period;            // bus cycles, 0 if not running
+  uint64_t due;               // SimNow of the next timeout
+  volatile uint32_t *tav;     // down counter register
+  volatile uint32_t *ris;     // raw interrupt status, NULL for SysTick
+  int oneshot;                // stops after one timeout
+  volatile uint32_t *ctl;     // control of a one-shot timer that runs
+                              // while TAEN is set, or NULL
+  uint32_t shadow;            // value last written to *tav by the simulator
+  int pending;
+};
+typedef struct source sourceType;
+#define SYSTICK 0
+#define BUTTON  4             // Lab 4 only
+#define BUDGET  5             // Lab 4 only, one-shot
+#define TIMEBASE 6            // Lab 4 only, match of the 64-bit Wide Timer 2
+#define SOFTIRQ  7            // Lab 4 only, Wide Timer 3B pended with NVIC_SW_TRIG_R
+#define NUMSOURCES 8
+#define BOUNCES  5            // falling edges per touch of button1
+#define BOUNCEUS 300          // us between them
+sourceType Sources[NUMSOURCES];
+
+volatile uint64_t SimNow;     // simulated bus cycles since start
+uint64_t SimEnd;              // stop here
+uint64_t SimIdle;             // cycles skipped by WaitForInterrupt
+volatile sig_atomic_t Primask = 1; // 1 means interrupts disabled
+int CurrentPriority = THREADLEVEL;
+volatile sig_atomic_t BasePri; // BASEPRI, 0 masks nothing
+int PendSV;                   // PendSV pending
+sigset_t TickSignal;          // SIGALRM
+uint8_t *Alias;               // writable view of the PPB window
+// the simulator's own writes to the read only SCB page
+#define ALIAS(reg) (*(volatile uint32_t *)(Alias+((uintptr_t)&(reg)-PPB)))
+int TickWasBlocked;           // SIGALRM state at the trapped store
+uint32_t ButtonMs;            // ms between touches of button1, 0 for none
+uint64_t TimeBase;            // SimNow when Wide Timer 2 was enabled
+int TimeBaseOn;
+uint64_t TimeMatch;           // match value last seen in its registers
+int BounceLeft;               // edges still to come in this touch
+
+// statistics
+uint32_t Switches;
+uint32_t Wakeups;
+int WakeSet;                  // a timer interrupt caused a switch
+uint64_t WakeSim;             // SimFine when that interrupt started
+uint64_t LatSum,LatMax;       // simulated bus cycles
+uint64_t HostStart;
+uint64_t StepHost;            // HostNs when SimNow last moved
+
+// ******** HostNs ************
+// Host time
+// Inputs:  none
+// Outputs: ns from an arbitrary start
+uint64_t static HostNs(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec*1000000000u+t.tv_nsec;
+}
+
+// ******** SimFine ************
+// Simulated time inside the current SLICEUS step; the host timer
+// moves SimNow once per step of host time, so the host time since
+// then, up to one step, is simulated time too
+// Inputs:  none
+// Outputs: simulated bus cycles since start
+uint64_t static SimFine(void){
+  uint64_t ns = HostNs()-StepHost;
+  if(ns > SLICEUS*1000u){
+    ns = SLICEUS*1000u;       // the next step is late
+  }
+  return SimNow+ns*(BUSFREQ/1000000)/1000;
+}
+
+// ******** SyncIn ************
+// Pick up register writes the OS made since the last SyncOut:
+// SysTick enable and STCURRENT clears, TAV changes (TickStretch)
+// Must be called with SIGALRM blocked
+void static SyncIn(void){
+  int i;
+  sourceType *s = &Sources[SYSTICK];
+  if((STCTRL&0x01) == 0){
+    s->period = 0;
+  } else if((s->period == 0)||(STCURRENT != s->shadow)){
+    s->period = (STRELOAD&0x00FFFFFF)+1; // started, or cleared by a write
+    s->due = SimNow+s->period;
+  }
+  for(i=1; i<NUMSOURCES; i++){
+    s = &Sources[i];
+    if(s->ctl){               // one-shot, runs while enabled
+      if(((*s->ctl)&TIMER_CTL_TAEN) == 0){
+        s->period = 0;
+      } else if(s->period == 0){
+        s->period = *s->tav+1;
+        s->due = SimNow+s->period;
+        continue;
+      }
+    }
+    if(s->period && s->tav && (*s->tav != s->shadow)){
+      s->due = SimNow+*s->tav;
+    }
+  }
+#if LAB == 4
+  s = &Sources[BUDGET];
+  s->priority = (NVIC_PRI24_R>>5)&0x07; // set by os.c
+  Sources[SOFTIRQ].priority = (NVIC_PRI25_R>>13)&0x07;
+  s = &Sources[TIMEBASE];
+  if(!TimeBaseOn && (WTIMER2_CTL_R&TIMER_CTL_TAEN)){
+    TimeBaseOn = 1;           // counts up from 0
+    TimeBase = SimNow;
+    TimeMatch = ~0ull;
+  }
+  if(TimeBaseOn){
+    uint64_t match = ((uint64_t)WTIMER2_TBMATCHR_R<<32)|WTIMER2_TAMATCHR_R;
+    s->priority = (NVIC_PRI24_R>>21)&0x07;
+    if(match != TimeMatch){   // a new match, also if it has passed
+      TimeMatch = match;
+      s->period = (match == ~0ull) ? 0 : 1;
+      s->due = TimeBase+match;
+    }
+  }
+#endif
+#if LAB == 4
+  s = &Sources[BUTTON];
+  if(ButtonMs && (s->period == 0) && (NVIC_EN0_R&0x08)){
+    s->priority = NVIC_PRI0_R>>29;  // set by OS_Edge_Init
+    s->period = ButtonMs*(BUSFREQ/1000);
+    s->due = SimNow+s->period;
+    BounceLeft = BOUNCES;
+  }
+#endif
+}
+
+// ******** SyncOut ************
+// Show the simulated state in the registers the OS reads
+// Must be called with SIGALRM blocked
+void static SyncOut(void){
+  int i;
+  for(i=0; i<NUMSOURCES; i++){
+    sourceType *s = &Sources[i];
+    if(s->period){
+      s->shadow = (uint32_t)(s->due-SimNow);
+      if(i == SYSTICK){
+        ALIAS(STCURRENT) = s->shadow;
+      } else if(s->tav){
+        *s->tav = s->shadow;
+      }
+    }
+    if(s->ris){
+      *s->ris = s->pending ? TIMER_RIS_TATORIS : 0;
+    }
+  }
+  DWTCYCCNT = (uint32_t)SimNow;
+#if LAB == 4
+  if(TimeBaseOn){
+    WTIMER2_TAV_R = (uint32_t)(SimNow-TimeBase);
+    WTIMER2_TBV_R = (uint32_t)((SimNow-TimeBase)>>32);
+  }
+#endif
+}
+
+// ******** Advance ************
+// Move simulated time forward, marking timers that time out
+// Inputs:  new SimNow
+// Must be called with SIGALRM blocked
+void static Advance(uint64_t time){
+  int i;
+  SimNow = time;
+  StepHost = HostNs();
+  for(i=0; i<NUMSOURCES; i++){
+    sourceType *s = &Sources[i];
+    if(s->period && (s->due <= time)){
+      s->pending = 1;       // timeouts while pending are lost, as in hardware
+      if(s->oneshot){       // a one-shot timer stops
+        s->period = 0;
+        if(s->ctl){
+          *s->ctl &= ~TIMER_CTL_TAEN;
+        }
+        continue;
+      }
+      while(s->due <= time){
+        s->due = s->due+s->period;
+      }
+    }
+  }
+}
+
+// ******** Latch ************
+// Turn writes to INTCTRL into pending PendSV and SysTick, and in
+// Lab 4 writes to NVIC_SW_TRIG_R into a pending Wide Timer 3B
+void static Latch(void){
+  uint32_t v;
+#if LAB == 4
+  v = NVIC_SW_TRIG_R;
+  if(v){
+    ALIAS(NVIC_SW_TRIG_R) = 0;
+    if(v == 101){
+      Sources[SOFTIRQ].pending = 1;
+    }
+  }
+  v = NVIC_UNPEND3_R;
+  if(v){
+    ALIAS(NVIC_UNPEND3_R) = 0;
+    if(v&0x01){               // IRQ 96, Wide Timer 1A
+      Sources[BUDGET].pending = 0;
+    }
+  }
+#endif
+  v = INTCTRL;
+  if(v == 0){
+    return;
+  }
+  ALIAS(INTCTRL) = 0;
+  if(v&0x10000000) PendSV = 1;     // PENDSVSET
+  if(v&0x08000000) PendSV = 0;     // PENDSVCLR
+  if(v&0x04000000) Sources[SYSTICK].pending = 1; // PENDSTSET
+  if(v&0x02000000) Sources[SYSTICK].pending = 0; // PENDSTCLR
+}
+
+void static Report(void);
+int Failed;                   // exit status, Report sets it to 1 if the test failed
+// ******** CheckEnd ************
+// Stop when the simulated time is up
+void static CheckEnd(void){
+  if(SimNow >= SimEnd){
+    Report();
+    exit(Failed);
+  }
+}
+
+// ******** ScbOpen, ScbClose ************
+// Make the SCB page writable while interrupt handlers run, and
+// read only again before going back to thread code
+int ScbWritable;
+void static ScbOpen(void){
+  if(!ScbWritable){
+    ScbWritable = 1;
+    mprotect((void *)SCB, PAGESIZE, PROT_READ|PROT_WRITE);
+  }
+}
+void static ScbClose(void){
+  if(ScbWritable){
+    Latch();
+    ScbWritable = 0;
+    mprotect((void *)SCB, PAGESIZE, PROT_READ);
+  }
+}
+
+// ******** Context ************
+// Host context of a thread, made the first time it runs
+struct context {
+  void *tcb;
+  ucontext_t uc;
+};
+struct context Contexts[NUMCTX];
+int NumContexts;
+void static ThreadStart(void);
+ucontext_t *Context(void *tcb){
+  struct context *c;
+  int i;
+  for(i=0; i<NumContexts; i++){
+    if(Contexts[i].tcb == tcb){
+      return &Contexts[i].uc;
+    }
+  }
+  if(NumContexts == NUMCTX){
+    fprintf(stderr, "hostsim: more than %d threads\n", NUMCTX);
+    exit(1);
+  }
+  c = &Contexts[NumContexts++];
+  c->tcb = tcb;
+  getcontext(&c->uc);
+  c->uc.uc_stack.ss_sp = malloc(CTXSTACK);
+  c->uc.uc_stack.ss_size = CTXSTACK;
+  c->uc.uc_link = NULL;
+  sigaddset(&c->uc.uc_sigmask, SIGALRM); // ThreadStart unblocks it
+  makecontext(&c->uc, ThreadStart, 0);
+  return &c->uc;
+}
+
+// ******** Woken ************
+// Called on the new thread right after a context switch
+void static Woken(void){
+  uint64_t latency;
+  Switches++;
+  if(WakeSet){
+    WakeSet = 0;
+    latency = SimFine()-WakeSim;
+    Wakeups++;
+    LatSum += latency;
+    if(latency > LatMax){
+      LatMax = latency;
+    }
+  }
+}
+
+// ******** ThreadStart ************
+// First code run on a thread's context, jumps to the address
+// SetInitialStack put in the PC slot of the initial stack frame
+void static ThreadStart(void){
+  int32_t *sp = *(int32_t **)RunPt;
+  void (*task)(void) = (void (*)(void))(uintptr_t)(uint32_t)sp[14];
+  Woken();
+  CurrentPriority = THREADLEVEL;
+  Primask = 0;              // threads run with interrupts enabled
+  BasePri = 0;
+  sigprocmask(SIG_UNBLOCK, &TickSignal, NULL);
+  task();
+  fprintf(stderr, "hostsim: a thread returned\n");
+  exit(1);
+}
+
+#if LAB == 4
+uint32_t ButtonTouches,ButtonEdges,ButtonTaken;
+// ******** ButtonEdge ************
+// One falling edge of button1, the BUTTON source's ISR; sets
+// when the next edge of this touch, or the next touch, happens
+void static ButtonEdge(void){
+  sourceType *s = &Sources[BUTTON];
+  if(BounceLeft == BOUNCES){
+    ButtonTouches++;
+  }
+  ButtonEdges++;
+  GPIO_PORTD_RIS_R = (GPIO_PORTD_RIS_R&~GPIO_PORTD_ICR_R)|0x40;
+  GPIO_PORTD_ICR_R = 0;
+  if(GPIO_PORTD_IM_R&0x40){
+    ButtonTaken++;
+    GPIOPortD_Handler();
+    GPIO_PORTD_RIS_R &= ~GPIO_PORTD_ICR_R;
+    GPIO_PORTD_ICR_R = 0;
+  }
+  BounceLeft--;
+  if(BounceLeft){
+    s->due = SimNow+(uint64_t)BOUNCEUS*(BUSFREQ/1000000);
+  } else{
+    BounceLeft = BOUNCES;
+    s->due = SimNow+s->period-(uint64_t)(BOUNCES-1)*BOUNCEUS*(BUSFREQ/1000000);
+  }
+}
+#endif
+
+// ******** Switch ************
+// The context switch of osasm.s: PendSV_Handler in Lab 4,
+// SysTick_Handler in Lab 3
+// Must be called with SIGALRM blocked
+void static Switch(void){
+  void *old = RunPt;
+#if LAB == 4
+  BasePri = KernelBasePri;  // MSR BASEPRI
+  Scheduler();
+  BasePri = 0;
+#else
+  Primask = 1;              // CPSID I
+  Scheduler();
+  Primask = 0;              // CPSIE I
+#endif
+  if(RunPt != old){
+    ScbClose();
+    swapcontext(Context(old), Context(RunPt));
+    Woken();                // now running on the new thread
+  } else{
+    WakeSet = 0;            // the same thread goes on, nothing to measure
+  }
+}
+
+// ******** Preempts ************
+// Outputs: 1 if an interrupt at this priority can run now,
+//          ignoring PRIMASK
+int static Preempts(uint32_t priority){
+  return (priority < (uint32_t)CurrentPriority) &&
+         ((BasePri == 0)||((priority<<5) < (uint32_t)BasePri));
+}
+
+// ******** Dispatch ************
+// Run pending interrupts that beat the current priority, highest
+// priority first, then PendSV if returning to a thread
+// Must be called with SIGALRM blocked and interrupts enabled
+void static Dispatch(void){
+  int saved = CurrentPriority;
+  int i;
+  sourceType *s;
+  while(1){
+    Latch();
+    s = NULL;
+    for(i=0; i<NUMSOURCES; i++){
+      if(Sources[i].pending && Preempts(Sources[i].priority) &&
+         ((s == NULL)||(Sources[i].priority < s->priority))){
+        s = &Sources[i];
+      }
+    }
+    if(s){
+      uint64_t start = SimFine();
+      s->pending = 0;       // acknowledge
+      if(s->ris){
+        *s->ris = TIMER_RIS_TATORIS; // the ISR sees why it runs
+      }
+      CurrentPriority = s->priority;
+      ScbOpen();            // no traps in ISRs, Latch sees their writes
+      s->isr();
+      CurrentPriority = saved;
+      if(s->ris){
+        *s->ris = 0;        // cleared through ICR by the ISR
+      }
+      Latch();
+      if((s != &Sources[SYSTICK]) && !WakeSet && PendSV){
+        WakeSet = 1;        // this interrupt readied a better thread
+        WakeSim = start;
+      }
+      continue;
+    }
+    if(PendSV && Preempts(7)){
+      ScbClose();
+      PendSV = 0;
+      CurrentPriority = 7;  // PendSV runs at the lowest priority
+      Switch();
+      CurrentPriority = saved;
+      continue;
+    }
+    break;
+  }
+  if(saved == THREADLEVEL){
+    ScbClose();             // back to a thread
+  }
+}
+
+// ******** Work ************
+// Outputs: 1 if an interrupt is waiting for PRIMASK or BASEPRI to clear
+int static Work(void){
+  int i;
+  if(INTCTRL || (PendSV && Preempts(7))){
+    return 1;
+  }
+  for(i=0; i<NUMSOURCES; i++){
+    if(Sources[i].pending && Preempts(Sources[i].priority)){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// ******** Run ************
+// Take pending interrupts now that PRIMASK or BASEPRI is lower
+void static Run(void){
+  sigset_t old;
+  sigprocmask(SIG_BLOCK, &TickSignal, &old);
+  SyncIn();
+  SyncOut();
+  if(!Primask){
+    Dispatch();
+  }
+  sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+// ******** StoreFault ************
+// A store to the SCB page: let the one instruction write it, with
+// SIGALRM held off, then StoreDone looks at what it wrote
+void static StoreFault(int sig, siginfo_t *info, void *context){
+  ucontext_t *uc = context;
+  uintptr_t addr = (uintptr_t)info->si_addr;
+  if((addr < SCB)||(addr >= SCB+PAGESIZE)){
+    signal(SIGSEGV, SIG_DFL); // a real bug, fault again and stop
+    return;
+  }
+  mprotect((void *)SCB, PAGESIZE, PROT_READ|PROT_WRITE);
+  TickWasBlocked = sigismember(&uc->uc_sigmask, SIGALRM);
+  sigaddset(&uc->uc_sigmask, SIGALRM);
+  uc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+}
+
+// ******** StoreDone ************
+// Single step trap after the store
+void static StoreDone(int sig, siginfo_t *info, void *context){
+  ucontext_t *uc = context;
+  uc->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+  if(!TickWasBlocked){
+    sigdelset(&uc->uc_sigmask, SIGALRM);
+  }
+  Latch();
+  mprotect((void *)SCB, PAGESIZE, PROT_READ);
+  if(!TickWasBlocked){      // a thread wrote it, not the simulator or an ISR
+    SyncIn();
+    SyncOut();
+    if(!Primask){
+      Dispatch();
+    }
+  }
+}
+
+// ******** Tick ************
+// Host timer signal: SLICEUS of simulated time went by
+void static Tick(int sig){
+  (void)sig;
+  SyncIn();
+  Advance(SimNow+(uint64_t)SLICEUS*(BUSFREQ/1000000));
+  SyncOut();
+  CheckEnd();
+  if(!Primask){
+    Dispatch();
+  }
+}
+
+//------------CortexM.h, normally in startup.s------------
+void DisableInterrupts(void){
+  Primask = 1;
+}
+void EnableInterrupts(void){
+  Primask = 0;
+  if(Work()){
+    Run();
+  }
+}
+long StartCritical(void){
+  long sr = Primask;
+  Primask = 1;
+  return sr;
+}
+void EndCritical(long sr){
+  Primask = sr;
+  if(!sr && Work()){
+    Run();
+  }
+}
+// sleep until the next interrupt, skipping simulated time; like
+// WFI only an interrupt that could preempt wakes it, so PendSV
+// idling with SysTick pending behind it still advances time
+void WaitForInterrupt(void){
+  sigset_t old;
+  uint64_t next = 0;
+  int i,pending = 0;
+  sigprocmask(SIG_BLOCK, &TickSignal, &old);
+  Latch();
+  SyncIn();
+  for(i=0; i<NUMSOURCES; i++){
+    pending = pending || (Sources[i].pending && (Sources[i].priority < CurrentPriority));
+    if(Sources[i].period && ((next == 0)||(Sources[i].due < next))){
+      next = Sources[i].due;
+    }
+  }
+  if(!pending && !(PendSV && (CurrentPriority > 7))){
+    if(next == 0){
+      fprintf(stderr, "hostsim: WaitForInterrupt with no timer running\n");
+      Report();
+      exit(1);
+    }
+    SimIdle += next-SimNow;
+    Advance(next);
+  }
+  SyncOut();
+  CheckEnd();
+  if(!Primask){
+    Dispatch();
+  }
+  sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+//------------osasm.s------------
+#if LAB == 4
+long BasePriRaise(uint32_t basepri){
+  long sr = BasePri;
+  if(basepri && ((BasePri == 0)||(basepri < (uint32_t)BasePri))){
+    BasePri = basepri;      // BASEPRI_MAX
+  }
+  return sr;
+}
+void BasePriSet(long basepri){
+  BasePri = basepri;
+  if(!Primask && Work()){
+    Run();
+  }
+}
+#endif
+void StartOS(void){
+  sigprocmask(SIG_BLOCK, &TickSignal, NULL);
+  Switches = 0;
+  setcontext(Context(RunPt)); // ThreadStart enables interrupts
+}
+
+//------------BSP.c, clock and timers------------
+void BSP_Clock_InitFastest(void){
+}
+uint32_t BSP_Clock_GetFreq(void){
+  return BUSFREQ;
+}
+void static TimerInit(int i, void(*task)(void), uint32_t freq, uint8_t priority){
+  sigset_t old;
+  sigprocmask(SIG_BLOCK, &TickSignal, &old);
+  Sources[i].isr = task;
+  Sources[i].priority = priority;
+  Sources[i].period = BUSFREQ/freq;
+  Sources[i].due = SimNow+Sources[i].period;
+  Sources[i].pending = 0;
+  SyncOut();
+  sigprocmask(SIG_SETMASK, &old, NULL);
+}
+void BSP_PeriodicTask_Init(void(*task)(void), uint32_t freq, uint8_t priority){
+  TimerInit(1, task, freq, priority);        // Wide Timer 5A
+}
+void BSP_PeriodicTask_InitB(void(*task)(void), uint32_t freq, uint8_t priority){
+  TimerInit(2, task, freq, priority);        // Wide Timer 4A
+}
+void BSP_PeriodicTask_InitC(void(*task)(void), uint32_t freq, uint8_t priority){
+  TimerInit(3, task, freq, priority);        // Wide Timer 3A
+}
+void BSP_Delay1ms(uint32_t n){
+  uint64_t end = SimNow+(uint64_t)n*(BUSFREQ/1000);
+  while(SimNow < end){};    // Tick moves SimNow
+}
+
+//------------test mains------------
+struct test {
+  const char *name;
+  int (*main)(void);
+  const char *about;
+  uint32_t button;            // ms between touches of button1, 0 for none
+  uint32_t edf;               // 1 fails the test if an EDF build misses a deadline
+  uint32_t *errors;           // error counter the test main keeps, nonzero fails the test
+  const char *errorName;
+};
+#define ERRORS(counter) &counter, #counter
+#if LAB == 4
+int LabMain(void); int main_real(void); int main_step1(void); int main_step2(void);
+int main_semabench(void); int main_pitest(void);
+int main_flagtest(void); int main_queuetest(void); int main_ringtest(void);
+int main_timeouttest(void); int main_edgetest(void); int main_timertest(void);
+int main_defertest(void); int main_quantumtest(void);
+int main_servertest(void); int main_stormtest(void); int main_sleeptest(void);
+int main_edftest(void); int main_jittertest(void);
+extern uint32_t QueueErrors,WatchErrors,TimerErrors,MsgErrors,SoundMisses,SleepErrors;
+struct test Tests[] = {
+  {"step1", main_step1, "TaskA-TaskH, OS_AddThreads and sleeping"},
+  {"step2", main_step2, "TaskI-TaskP, periodic triggers"},
+  {"step3", LabMain, "TaskI-TaskR, periodic and edge triggers", 100},
+  {"real", main_real, "fitness device with stub sensors and LCD", 1000},
+  {"semabench", main_semabench, "OS_Signal cost with seven blocked threads"},
+  {"pitest", main_pitest, "priority inheritance on a mutex"},
+  {"flagtest", main_flagtest, "one thread serving several event flags"},
+  {"queuetest", main_queuetest, "two pipelines with their own message queues", 0, 0, ERRORS(QueueErrors)},
+  {"ringtest", main_ringtest, "lock-free ring from a 1 kHz ISR to a thread"},
+  {"timeouttest", main_timeouttest, "OS_WaitTimeout on a sensor that hangs, and OS_TryWait", 0, 0, ERRORS(WatchErrors)},
+  {"edgetest", main_edgetest, "debounced edge triggers, button1 touched every 50 ms", 50},
+  {"timertest", main_timertest, "one-shot and periodic software timers", 0, 0, ERRORS(TimerErrors)},
+  {"defertest", main_defertest, "ISR posting jobs to the kernel's work queue", 0, 0, ERRORS(MsgErrors)},
+  {"quantumtest", main_quantumtest, "round robin with 1, 2 and 4 slice quanta"},
+  {"servertest", main_servertest, "sporadic server, button1 storm every 2 ms", 2, 0, ERRORS(SoundMisses)},
+  {"stormtest", main_stormtest, "servertest with no server", 2},
+  {"sleeptest", main_sleeptest, "OS_SleepUntil every 250 us and OS_SleepUs(100)", 0, 0, ERRORS(SleepErrors)},
+  {"edftest", main_edftest, "deadline inheritance through a mutex, build with -DEDF=1", 0, 1},
+  {"jittertest", main_jittertest, "1 ms samples from the priority 0 sampler and a thread"},
+};
+#else
+int LabMain(void); int main_step1(void); int main_step2(void); int main_step3(void);
+int main_step4(void); int main_step5(void);
+struct test Tests[] = {
+  {"step1", main_step1, "TaskA-TaskC, semaphores"},
+  {"step2", main_step2, "TaskA-TaskF, blocking semaphores"},
+  {"step3", main_step3, "TaskG-TaskL, FIFO"},
+  {"step4", main_step4, "TaskM-TaskR, sleeping"},
+  {"step5", main_step5, "TaskS-TaskZ, periodic event threads"},
+  {"real", LabMain, "fitness device with stub sensors and LCD"},
+};
+#endif
+#define NUMTESTS (sizeof(Tests)/sizeof(Tests[0]))
+const char *TestName;
+uint32_t CheckMisses;         // 1 if this test must not miss a deadline
+uint32_t *ErrorCount;         // the test's error counter, NULL if it has none
+const char *ErrorName;
+
+void static Report(void){
+  double simSec = SimNow/(double)BUSFREQ;
+  double hostSec = (HostNs()-HostStart)/1e9;
+  printf("Lab %d %s: %.3f s simulated in %.3f s\n", LAB, TestName, simSec, hostSec);
+  printf("  idle %.1f%%\n", simSec > 0 ? 100.0*SimIdle/SimNow : 0.0);
+#if LAB == 4
+  printf("  OS_CPULoad %.1f%% over the last window\n", OS_CPULoad()/10.0);
+#endif
+  printf("  context switches %u, %.0f per simulated s, %.0f per host s\n",
+         Switches, simSec > 0 ? Switches/simSec : 0.0, hostSec > 0 ? Switches/hostSec : 0.0);
+#if LAB == 4
+  if(ButtonMs){
+    printf("  button1 touched %u times, %u edges, %u interrupts\n",
+           ButtonTouches, ButtonEdges, ButtonTaken);
+  }
+  if(DeadlineHeap){         // os.c built with EDF 1
+    printf("  EDF deadline misses %u\n", OS_DeadlineMisses());
+    if(CheckMisses && OS_DeadlineMisses()){
+      Failed = 1;
+    }
+  }
+#endif
+  if(ErrorCount){
+    printf("  %s %u\n", ErrorName, *ErrorCount);
+    if(*ErrorCount){
+      Failed = 1;
+    }
+  }
+  if(Wakeups){
+    printf("  wake up latency (timer interrupt to switch) %u times,"
+           " simulated avg %.2f us max %.2f us\n",
+           Wakeups, LatSum/(double)Wakeups/(BUSFREQ/1000000),
+           (double)LatMax/(BUSFREQ/1000000));
+  }
+}
+
+// ******** MapRegisters ************
+// Back the peripheral and system control address ranges with
+// memory, and make the clock ready bits read as ready
+void static MapRegisters(void){
+  int fd = memfd_create("ppb", 0);
+  if((fd < 0)||(ftruncate(fd, PPBSIZE) != 0)||
+     (mmap((void *)0x40000000, 0x00100000, PROT_READ|PROT_WRITE,
+           MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0) != (void *)0x40000000)||
+     (mmap((void *)PPB, PPBSIZE, PROT_READ|PROT_WRITE,
+           MAP_SHARED|MAP_FIXED_NOREPLACE, fd, 0) != (void *)PPB)||
+     ((Alias = mmap(NULL, PPBSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)||
+     (mprotect((void *)SCB, PAGESIZE, PROT_READ) != 0)){
+    perror("hostsim: mapping registers");
+    exit(1);
+  }
+  SYSCTL_PRGPIO_R = 0xFFFFFFFF;
+  SYSCTL_PRTIMER_R = 0xFFFFFFFF;
+  SYSCTL_PRWTIMER_R = 0xFFFFFFFF;
+  SYSCTL_PRADC_R = 0xFFFFFFFF;
+  SYSCTL_PRSSI_R = 0xFFFFFFFF;
+  SYSCTL_PRI2C_R = 0xFFFFFFFF;
+  SYSCTL_PRUART_R = 0xFFFFFFFF;
+  SYSCTL_PRPWM_R = 0xFFFFFFFF;
+}
+
+int main(int argc, char **argv){
+  struct sigaction sa;
+  struct itimerval it;
+  struct test *t = &Tests[LAB == 4 ? 2 : NUMTESTS-1];
+  double seconds = 10;
+  unsigned i;
+  if(argc > 1){
+    for(t=NULL,i=0; i<NUMTESTS; i++){
+      if(strcmp(argv[1], Tests[i].name) == 0){
+        t = &Tests[i];
+      }
+    }
+    if(t == NULL){
+      printf("usage: %s [test] [simulated seconds], tests:\n", argv[0]);
+      for(i=0; i<NUMTESTS; i++){
+        printf("  %-10s %s\n", Tests[i].name, Tests[i].about);
+      }
+      return strcmp(argv[1], "list") != 0;
+    }
+  }
+  if(argc > 2){
+    seconds = atof(argv[2]);
+  }
+  TestName = t->name;
+  CheckMisses = t->edf;
+  ErrorCount = t->errors;
+  ErrorName = t->errorName;
+  ButtonMs = t->button;
+  SimEnd = (uint64_t)(seconds*BUSFREQ);
+  sigemptyset(&TickSignal);
+  sigaddset(&TickSignal, SIGALRM);
+  MapRegisters();
+  Sources[SYSTICK].name = "SysTick";
+  Sources[SYSTICK].priority = 7;
+  Sources[SYSTICK].tav = &STCURRENT;
+#if LAB == 4
+  Sources[SYSTICK].isr = SysTick_Handler;    // pends PendSV
+#else
+  Sources[SYSTICK].isr = Switch;             // switches threads itself
+#endif
+  Sources[1].name = "WideTimer5A";
+  Sources[1].tav = &WTIMER5_TAV_R;
+  Sources[1].ris = &WTIMER5_RIS_R;
+  Sources[2].name = "WideTimer4A";
+  Sources[2].tav = &WTIMER4_TAV_R;
+  Sources[2].ris = &WTIMER4_RIS_R;
+  Sources[3].name = "WideTimer3A";
+  Sources[3].tav = &WTIMER3_TAV_R;
+  Sources[3].ris = &WTIMER3_RIS_R;
+#if LAB == 4
+  Sources[BUTTON].name = "GPIOPortD";
+  Sources[BUTTON].isr = ButtonEdge;
+  Sources[BUDGET].name = "WideTimer1A";
+  Sources[BUDGET].isr = WideTimer1A_Handler;
+  Sources[BUDGET].tav = &WTIMER1_TAV_R;
+  Sources[BUDGET].ris = &WTIMER1_RIS_R;
+  Sources[BUDGET].ctl = &WTIMER1_CTL_R;
+  Sources[BUDGET].oneshot = 1;
+  Sources[TIMEBASE].name = "WideTimer2A";
+  Sources[TIMEBASE].isr = WideTimer2A_Handler;
+  Sources[TIMEBASE].oneshot = 1;
+  Sources[SOFTIRQ].name = "WideTimer3B";
+  Sources[SOFTIRQ].isr = WideTimer3B_Handler;
+#endif
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = Tick;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGALRM, &sa, NULL);
+  sa.sa_handler = NULL;
+  sa.sa_sigaction = StoreFault;
+  sa.sa_flags = SA_SIGINFO;
+  sigaddset(&sa.sa_mask, SIGALRM);
+  sigaction(SIGSEGV, &sa, NULL);
+  sa.sa_sigaction = StoreDone;
+  sa.sa_flags = SA_SIGINFO|SA_NODEFER;
+  sigaction(SIGTRAP, &sa, NULL);
+  it.it_interval.tv_sec = 0;
+  it.it_interval.tv_usec = SLICEUS;
+  it.it_value = it.it_interval;
+  setitimer(ITIMER_REAL, &it, NULL);
+  HostStart = HostNs();
+  t->main();                // normally ends in OS_Launch
+  Report();
+  return Failed;
+}
@@ -0,0 +1,34 @@
+// hostsim.h
+// Runs on Linux
+// Stand-ins for the Keil ARM compiler intrinsics used by os.c,
+// so the kernel builds unchanged with gcc on the host.
+// Included ahead of every source file with gcc -include hostsim.h,
+// see hostsim.c for the complete build command.
+
+#ifndef __HOSTSIM_H
+#define __HOSTSIM_H  1
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  1  // ucontext registers and memfd_create in hostsim.c
+#endif
+#include <stdint.h>
+
+// count leading zeros, 32 for 0 like the CLZ instruction
+#define __clz(x)      ((x) ? (uint32_t)__builtin_clz(x) : 32)
+// LDREX/STREX as used by TraceWrite: the store of count+1
+// fails if the count changed since it was read
+#define __ldrex(p)    (*(p))
+#define __strex(v,p)  (!__sync_bool_compare_and_swap((p), (v)-1, (v)))
+
+// 8-byte aligned stacks, as the AAPCS requires at every call
+#define __align(n)    __attribute__((aligned(n)))
+
+// os.c keeps addresses in 32-bit words (stack frames, trace ids,
+// GPIO bases), which is exact on the board; with -no-pie the host's
+// code and data are below 4 GB too, so the casts lose nothing
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
+
+// the lab's main() becomes LabMain(), hostsim.c has the real main
+#define main LabMain
+
+#endif
@@ -56,9 +56,9 @@ uint32_t SoundRMS;          // Root Mean Square average of most recent sound sam
 uint32_t LightData;         // 100 lux
 int32_t TemperatureData;    // 0.1C
 // semaphores
-int32_t NewData;  // true when new numbers to display on top of LCD
-int32_t LCDmutex; // exclusive access to LCD
-int32_t I2Cmutex; // exclusive access to I2C
+semaType NewData; // true when new numbers to display on top of LCD
+semaType LCDmutex; // exclusive access to LCD
+semaType I2Cmutex; // exclusive access to I2C
 int ReDrawAxes = 0;         // non-zero means redraw axes on next display task
 
 enum plotstate{
@@ -468,7 +468,7 @@ void Task7(void){
 // Remember that you must have exactly one main() function, so
 // to work on this step, you must rename all other main()
 // functions in this file.
-int32_t s1,s2;
+semaType s1,s2;
 int main_step1(void){
   OS_InitSemaphore(&s1, 0);
   OS_InitSemaphore(&s2, 1);
@@ -499,7 +499,7 @@ int main_step1(void){
 // Remember that you must have exactly one main() function, so
 // to work on this step, you must rename all other main()
 // functions in this file.
-int32_t sAB,sCD,sEF;
+semaType sAB,sCD,sEF;
 int32_t CountA,CountB,CountC,CountD,CountE,CountF;
 void TaskA(void){ // producer
   CountA = 0;
@@ -816,7 +816,7 @@ void TaskT(void){ // consumer as main thread
   }
 }
 int32_t CountU=0;
-int32_t sUV;
+semaType sUV;
 void TaskU(void){ // event thread every 100 ms
   CountU++;
   TExaS_Task2();
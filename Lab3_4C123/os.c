@@ -19,26 +19,65 @@ struct tcb {
   int32_t *sp;       // pointer to stack (valid for threads not running
   struct tcb *next;  // linked-list pointer
   // nonzero if blocked on this semaphore
-  int32_t *semaPt;
+  semaType *semaPt;
+  // next thread blocked on the same semaphore
+  struct tcb *nextBlocked;
   // nonzero if this thread is sleeping
   int32_t sleep;
+  // sleeping threads are sorted by wake up time, and each one
+  // stores the number of ms after the one before it (delta list)
+  struct tcb *nextSleep;
+  uint32_t delta;
 };
 
 typedef struct tcb tcbType;
 tcbType tcbs[NUMTHREADS];
 tcbType *RunPt;
 int32_t Stacks[NUMTHREADS][STACKSIZE];
+tcbType *SleepPt;            // first thread to wake up, NULL if none sleeping
+
+// ******** SleepInsert ************
+// Put a thread into the sorted list of sleeping threads
+// Inputs:  thread to put to sleep
+//          number of msec to sleep, greater than zero
+// Outputs: none
+// Must be called with interrupts disabled
+void static SleepInsert(tcbType *thread, uint32_t sleepTime){
+  tcbType *prev = NULL;
+  tcbType *cur = SleepPt;
+  while (cur && cur->delta <= sleepTime) {  // after those that wake up first
+    sleepTime = sleepTime - cur->delta;
+    prev = cur;
+    cur = cur->nextSleep;
+  }
+  thread->delta = sleepTime;
+  thread->nextSleep = cur;
+  if (cur) {
+    cur->delta = cur->delta - sleepTime;    // cur now wakes up after thread
+  }
+  if (prev) {
+    prev->nextSleep = thread;
+  } else {
+    SleepPt = thread;
+  }
+}
 
 void static runperiodicevents(void){
 // ****IMPLEMENT THIS****
 // **RUN PERIODIC THREADS, DECREMENT SLEEP COUNTERS
-  tcbType *cur = RunPt;
-  do {
-    if (cur->sleep) {
-      cur->sleep--;
+  tcbType *cur;
+  long sr = StartCritical();
+  // only the first sleeping thread is counted down,
+  // the others are stored relative to it
+  if (SleepPt) {
+    SleepPt->delta--;
+    while (SleepPt && SleepPt->delta == 0) {
+      cur = SleepPt;          // done sleeping
+      SleepPt = cur->nextSleep;
+      cur->sleep = 0;
     }
-    cur = cur->next;
-  } while (cur != RunPt);
+  }
+  EndCritical(sr);
 }
 
 // ******** OS_Init ************
@@ -105,6 +144,7 @@ int OS_AddThreads(void(*thread0)(void),
   tcbs[3].sleep = 0;
   tcbs[4].sleep = 0;
   tcbs[5].sleep = 0;
+  SleepPt = NULL;
 
   // initialize threads to be not blocking
   tcbs[0].semaPt = NULL;
@@ -208,8 +248,13 @@ void OS_Suspend(void){
 // output: none
 // OS_Sleep(0) implements cooperative multitasking
 void OS_Sleep(uint32_t sleepTime){
+  DisableInterrupts();
 // set sleep parameter in TCB
   RunPt->sleep = sleepTime;
+  if (sleepTime) {
+    SleepInsert(RunPt, sleepTime);
+  }
+  EnableInterrupts();
 // suspend, stops running
   OS_Suspend();
 }
@@ -219,9 +264,11 @@ void OS_Sleep(uint32_t sleepTime){
 // Inputs:  pointer to a semaphore
 //          initial value of semaphore
 // Outputs: none
-void OS_InitSemaphore(int32_t *semaPt, int32_t value){
+void OS_InitSemaphore(semaType *semaPt, int32_t value){
 //***IMPLEMENT THIS***
-  (*semaPt) = value;
+  semaPt->value = value;
+  semaPt->head = NULL;   // no threads blocked
+  semaPt->tail = NULL;
 }
 
 // ******** OS_Wait ************
@@ -230,14 +277,22 @@ void OS_InitSemaphore(int32_t *semaPt, int32_t value){
 // Lab3 block if less than zero
 // Inputs:  pointer to a counting semaphore
 // Outputs: none
-void OS_Wait(int32_t *semaPt){
+void OS_Wait(semaType *semaPt){
 //***IMPLEMENT THIS***
   DisableInterrupts();
 
-  (*semaPt) = (*semaPt) - 1;
+  semaPt->value = semaPt->value - 1;
 
-  if ((*semaPt) < 0) {
+  if (semaPt->value < 0) {
     RunPt->semaPt = semaPt;
+    // add to the end of the FIFO of blocked threads
+    RunPt->nextBlocked = NULL;
+    if (semaPt->head == NULL) {
+      semaPt->head = RunPt;
+    } else {
+      semaPt->tail->nextBlocked = RunPt;
+    }
+    semaPt->tail = RunPt;
     EnableInterrupts();
     OS_Suspend();
   }
@@ -251,18 +306,17 @@ void OS_Wait(int32_t *semaPt){
 // Lab3 wakeup blocked thread if appropriate
 // Inputs:  pointer to a counting semaphore
 // Outputs: none
-void OS_Signal(int32_t *semaPt){
+void OS_Signal(semaType *semaPt){
 //***IMPLEMENT THIS***
+  tcbType *cur;
   DisableInterrupts();
-	tcbType *cur;
-  (*semaPt) = (*semaPt) + 1;
-
-  if ((*semaPt <= 0)) {
-		cur = RunPt->next;
-		while (cur->semaPt != semaPt) {
-			cur = cur->next;
-		}
-		cur->semaPt = NULL;
+  semaPt->value = semaPt->value + 1;
+
+  if (semaPt->value <= 0) {
+    // wake up the thread that has been blocked the longest
+    cur = semaPt->head;
+    semaPt->head = cur->nextBlocked;
+    cur->semaPt = NULL;
   }
   EnableInterrupts();
 }
@@ -271,7 +325,7 @@ void OS_Signal(int32_t *semaPt){
 uint32_t PutI;      // index of where to put next
 uint32_t GetI;      // index of where to get next
 uint32_t Fifo[FSIZE];
-int32_t CurrentSize;// 0 means FIFO empty, FSIZE means full
+semaType CurrentSize;// 0 means FIFO empty, FSIZE means full
 uint32_t LostData;  // number of lost pieces of data
 
 // ******** OS_FIFO_Init ************
@@ -296,7 +350,7 @@ void OS_FIFO_Init(void){
 // Inputs:  data to be stored
 // Outputs: 0 if successful, -1 if the FIFO is full
 int OS_FIFO_Put(uint32_t data){
-  if (CurrentSize == FSIZE) {
+  if (CurrentSize.value == FSIZE) {
     LostData++;
     return -1; // queue is full
   }
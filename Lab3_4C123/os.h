@@ -83,12 +83,23 @@ void OS_Suspend(void);
 // OS_Sleep(0) implements cooperative multitasking
 void OS_Sleep(uint32_t sleepTime);
 
+struct tcb;                  // thread control block, private to os.c
+// counting semaphore
+// threads blocked on a semaphore wait in a FIFO list,
+// linked through their TCBs, so signal and wait are O(1)
+struct sema {
+  int32_t value;             // negative means -value threads are blocked
+  struct tcb *head;          // blocked the longest, next to wake up
+  struct tcb *tail;          // blocked most recently
+};
+typedef struct sema semaType;
+
 // ******** OS_InitSemaphore ************
 // Initialize counting semaphore
 // Inputs:  pointer to a semaphore
 //          initial value of semaphore
 // Outputs: none
-void OS_InitSemaphore(int32_t *semaPt, int32_t value);
+void OS_InitSemaphore(semaType *semaPt, int32_t value);
 
 // ******** OS_Wait ************
 // Decrement semaphore and block if less than zero
@@ -96,7 +107,7 @@ void OS_InitSemaphore(int32_t *semaPt, int32_t value);
 // Lab3 block if less than zero
 // Inputs:  pointer to a counting semaphore
 // Outputs: none
-void OS_Wait(int32_t *semaPt);
+void OS_Wait(semaType *semaPt);
 
 // ******** OS_Signal ************
 // Increment semaphore
@@ -104,7 +115,7 @@ void OS_Wait(int32_t *semaPt);
 // Lab3 wakeup blocked thread if appropriate
 // Inputs:  pointer to a counting semaphore
 // Outputs: none
-void OS_Signal(int32_t *semaPt);
+void OS_Signal(semaType *semaPt);
 
 // ******** OS_FIFO_Init ************
 // Initialize FIFO.
@@ -57,9 +57,9 @@ uint32_t SoundRMS;          // Root Mean Square average of most recent sound sam
 uint32_t LightData;         // 100 lux
 int32_t TemperatureData;    // 0.1C
 // semaphores
-int32_t NewData;  // true when new numbers to display on top of LCD
-int32_t LCDmutex; // exclusive access to LCD
-int32_t I2Cmutex; // exclusive access to I2C
+semaType NewData; // true when new numbers to display on top of LCD
+mutexType LCDmutex; // exclusive access to LCD
+mutexType I2Cmutex; // exclusive access to I2C
 int ReDrawAxes = 0;         // non-zero means redraw axes on next display task
 
 enum plotstate{
@@ -85,34 +85,48 @@ enum plotstate PlotState = Accelerometer;
 // High priority thread run by OS in real time at 1000 Hz
 #define SOUNDRMSLENGTH 1000 // number of samples to collect before calculating RMS (may overflow if greater than 4104)
 int16_t SoundArray[SOUNDRMSLENGTH];
-int32_t TakeSoundData; // binary semaphore
-int32_t ADCmutex;      // access to ADC
+#define SOUNDDEPTH 16       // samples waiting for Task0, power of 2
+semaType TakeSoundData; // binary semaphore
+ringType SoundRing;     // samples from SampleSound to Task0
+uint16_t SoundBuffer[SOUNDDEPTH];
+// *********SampleSound*********
+// Takes one microphone sample every 1 ms, run by the OS from
+// its priority 0 timer interrupt, so neither the kernel nor
+// other threads delay the sample. The microphone uses ADC0
+// sequencer 3 and the accelerometer sequencer 2, so Task1 can
+// read the accelerometer at the same time.
+// Inputs:  none
+// Outputs: none
+void SampleSound(void){uint16_t data;
+  BSP_Microphone_Input(&data);
+  OS_Ring_Put(&SoundRing, &data); // no wake semaphore, Task0 waits on TakeSoundData
+}
 // *********Task0*********
 // Task0 measures sound intensity
 // Periodic main thread runs in real time at 1000 Hz
-// collects data from microphone, high priority
+// processes data from microphone, high priority
 // Inputs:  none
 // Outputs: none
 void Task0(void){
   static int32_t soundSum = 0;
   static int time = 0;// units of microphone sampling rate
 
+  OS_SetDeadline(1);   // EDF mode: done within 1 ms of each release
   SoundRMS = 0;
   while(1){
-    OS_Wait(&TakeSoundData); // signaled by OS every 1ms
+    OS_Wait(&TakeSoundData); // signaled by OS every 1ms, after SampleSound
     TExaS_Task0();     // record system time in array, toggle virtual logic analyzer
     Profile_Toggle0(); // viewed by the logic analyzer to know Task0 started
-    OS_Wait(&ADCmutex);
-    BSP_Microphone_Input(&SoundData);
-    OS_Signal(&ADCmutex);
-    soundSum = soundSum + (int32_t)SoundData;
-    SoundArray[time] = SoundData;
-    time = time + 1;
-    if(time == SOUNDRMSLENGTH){
-      SoundAvg = soundSum/SOUNDRMSLENGTH;
-      soundSum = 0;
-      OS_Signal(&NewData); // makes task5 run every 1 sec
-      time = 0;
+    while(OS_Ring_Get(&SoundRing, &SoundData, 0)){ // more than one if Task0 was late
+      soundSum = soundSum + (int32_t)SoundData;
+      SoundArray[time] = SoundData;
+      time = time + 1;
+      if(time == SOUNDRMSLENGTH){
+        SoundAvg = soundSum/SOUNDRMSLENGTH;
+        soundSum = 0;
+        OS_Signal(&NewData); // makes task5 run every 1 sec
+        time = 0;
+      }
     }
   }
 }
@@ -122,8 +136,12 @@ void Task0(void){
 
 //---------------- Task1 measures acceleration ----------------
 // Event thread run by OS in real time at 10 Hz
-int32_t TakeAccelerationData;
-uint32_t LostTask1Data;     // number of times that the FIFO was full when acceleration data was ready
+semaType TakeAccelerationData;
+uint32_t LostTask1Data;     // number of times that AccQueue was full when acceleration data was ready
+uint32_t StaleDisplay;      // number of times Task5 updated the LCD without NewData
+#define ACCDEPTH 4          // Task2 may fall 400 ms behind while Task0/Task1 run
+queueType AccQueue;         // squared magnitudes from Task1 to Task2
+uint32_t AccBuffer[ACCDEPTH];
 uint16_t AccX, AccY, AccZ;  // returned by BSP as 10-bit numbers
 #define ALPHA 128           // The degree of weighting decrease, a constant smoothing factor between 0 and 1,023. A higher ALPHA discounts older observations faster.
                             // basic step counting algorithm is based on a forum post from
@@ -143,6 +161,7 @@ enum state AlgorithmState = LookingForMax;
 // Inputs:  none
 // Outputs: none
 void Task1(void){uint32_t squared;
+  OS_SetDeadline(100); // EDF mode: done before the next release
   // initialize the exponential weighted moving average filter
   BSP_Accelerometer_Input(&AccX, &AccY, &AccZ);
   Magnitude = sqrt32(AccX*AccX + AccY*AccY + AccZ*AccZ);
@@ -153,11 +172,9 @@ void Task1(void){uint32_t squared;
     OS_Wait(&TakeAccelerationData); // signaled by OS every 100ms
     TExaS_Task1();     // records system time in array, toggles virtual logic analyzer
     Profile_Toggle1(); // viewed by the logic analyzer to know Task1 started
-    OS_Wait(&ADCmutex);
     BSP_Accelerometer_Input(&AccX, &AccY, &AccZ);
-    OS_Signal(&ADCmutex);
     squared = AccX*AccX + AccY*AccY + AccZ*AccZ;
-    if(OS_FIFO_Put(squared) == -1){  // makes Task2 run every 100ms
+    if(OS_Queue_Put(&AccQueue, &squared, 0) == 0){  // makes Task2 run every 100ms
       LostTask1Data = LostTask1Data + 1;
     }
     Time++; // in 100ms units
@@ -181,7 +198,7 @@ void Task1(void){uint32_t squared;
 #define TEMP_MAX 1023
 #define TEMP_MIN 0
 void drawaxes(void){
-  OS_Wait(&LCDmutex);
+  OS_Lock(&LCDmutex);
   if(PlotState == Accelerometer){
     BSP_LCD_Drawaxes(AXISCOLOR, BGCOLOR, "Time", "Mag", MAGCOLOR, "Ave", EWMACOLOR, ACCELERATION_MAX, ACCELERATION_MIN);
   } else if(PlotState == Microphone){
@@ -191,7 +208,7 @@ void drawaxes(void){
   } else if(PlotState == Light){
     BSP_LCD_Drawaxes(AXISCOLOR, BGCOLOR, "Time", "Light", LIGHTCOLOR, "", 0, LIGHT_MAX, LIGHT_MIN);
   }
-  OS_Signal(&LCDmutex);  ReDrawAxes = 0;
+  OS_Unlock(&LCDmutex);  ReDrawAxes = 0;
 }
 void Task2(void){uint32_t data;
   uint32_t localMin;   // smallest measured magnitude since odd-numbered step detected
@@ -202,7 +219,7 @@ void Task2(void){uint32_t data;
   localCount = 0;
   drawaxes();
   while(1){
-    data = OS_FIFO_Get();
+    OS_Queue_Get(&AccQueue, &data, 1);
     TExaS_Task2();     // records system time in array, toggles virtual logic analyzer
     Profile_Toggle2(); // viewed by the logic analyzer to know Task2 started
     Magnitude = sqrt32(data);
@@ -258,7 +275,7 @@ void Task2(void){uint32_t data;
       drawaxes();
       ReDrawAxes = 0;
     }
-    OS_Wait(&LCDmutex);
+    OS_Lock(&LCDmutex);
     if(PlotState == Accelerometer){
       BSP_LCD_PlotPoint(Magnitude, MAGCOLOR);
       BSP_LCD_PlotPoint(EWMA, EWMACOLOR);
@@ -270,7 +287,7 @@ void Task2(void){uint32_t data;
       BSP_LCD_PlotPoint(LightData, LIGHTCOLOR);
     }
     BSP_LCD_PlotIncrement();
-    OS_Signal(&LCDmutex);
+    OS_Unlock(&LCDmutex);
   }
 }
 /* ****************************************** */
@@ -286,11 +303,20 @@ void Task2(void){uint32_t data;
 // checks the switches, updates the mode, and outputs to the buzzer and LED
 // Inputs:  none
 // Outputs: none
-int32_t SwitchTouch;
+semaType SwitchTouch;
+timerType BuzzerTimer;
+// ------------BuzzerOff------------
+// Timer callback that ends the beep
+// Input: none
+// Output: none
+void BuzzerOff(void){
+  BSP_Buzzer_Set(0);
+}
 void Task3(void){
   uint8_t current;
 	OS_InitSemaphore(&SwitchTouch,0); // signaled on touch button1
-	OS_EdgeTrigger_Init(&SwitchTouch, 3);
+  // button1 is J4.33, PD6; bounces are ignored for 20 ms
+  OS_Edge_Init(EDGE_PORTD, 6, EDGE_FALLING, 20, &SwitchTouch, NULL, 0, 3);
   while(1){
 		OS_Wait(&SwitchTouch); // OS signals on touch
     TExaS_Task3();         // records system time in array, toggles virtual logic analyzer
@@ -299,8 +325,7 @@ void Task3(void){
     current = BSP_Button1_Input();
     if(current == 0){     // Button1 was pressed
       BSP_Buzzer_Set(512);   // beep for 20ms
-      OS_Sleep(20);
-      BSP_Buzzer_Set(0);
+      OS_Timer_Start(&BuzzerTimer, &BuzzerOff, 20, 0);
       if(PlotState == Accelerometer){
         PlotState = Microphone;
       } else if(PlotState == Microphone){
@@ -312,7 +337,6 @@ void Task3(void){
       }
       ReDrawAxes = 1;      // redraw axes on next call of display task
     }
-		OS_EdgeTrigger_Restart();
   }
 }
 /* ****************************************** */
@@ -328,19 +352,20 @@ void Task3(void){
 // Outputs: none
 void Task4(void){int32_t voltData,tempData;
   int done;
+  OS_SetDeadline(1000); // EDF mode: done before the next reading
   while(1){
     TExaS_Task4();     // records system time in array, toggles virtual logic analyzer
     Profile_Toggle4(); // viewed by the logic analyzer to know Task4 started
 
-    OS_Wait(&I2Cmutex);
+    OS_Lock(&I2Cmutex);
     BSP_TempSensor_Start();
-    OS_Signal(&I2Cmutex);
+    OS_Unlock(&I2Cmutex);
     done = 0;
     OS_Sleep(1000);    // waits about 1 sec
     while(done == 0){
-      OS_Wait(&I2Cmutex);
+      OS_Lock(&I2Cmutex);
       done = BSP_TempSensor_End(&voltData, &tempData);
-      OS_Signal(&I2Cmutex);
+      OS_Unlock(&I2Cmutex);
     }
     TemperatureData = tempData/10000;
   }
@@ -361,14 +386,16 @@ void Task4(void){int32_t voltData,tempData;
 // Inputs:  none
 // Outputs: none
 void Task5(void){int32_t soundSum;
-  OS_Wait(&LCDmutex);
+  OS_Lock(&LCDmutex);
   BSP_LCD_DrawString(0,  0, "Temp=",  TOPTXTCOLOR);
   BSP_LCD_DrawString(0,  1, "Step=",  TOPTXTCOLOR);
   BSP_LCD_DrawString(10, 0, "Light=", TOPTXTCOLOR);
   BSP_LCD_DrawString(10, 1, "Sound=", TOPTXTCOLOR);
-  OS_Signal(&LCDmutex);
+  OS_Unlock(&LCDmutex);
   while(1){
-    OS_Wait(&NewData);
+    if(OS_WaitTimeout(&NewData, 1500) == 0){ // Task0 is late, refresh anyway
+      StaleDisplay = StaleDisplay + 1;
+    }
     TExaS_Task5();     // records system time in array, toggles virtual logic analyzer
     Profile_Toggle5(); // viewed by the logic analyzer to know Task5 started
     soundSum = 0;
@@ -376,7 +403,7 @@ void Task5(void){int32_t soundSum;
       soundSum = soundSum + (SoundArray[i] - SoundAvg)*(SoundArray[i] - SoundAvg);
     }
     SoundRMS = sqrt32(soundSum/SOUNDRMSLENGTH);
-    OS_Wait(&LCDmutex);
+    OS_Lock(&LCDmutex);
     BSP_LCD_SetCursor(5,  0); BSP_LCD_OutUFix2_1(TemperatureData, TEMPCOLOR);
     BSP_LCD_SetCursor(5,  1); BSP_LCD_OutUDec4(Steps,             MAGCOLOR);
     BSP_LCD_SetCursor(16, 0); BSP_LCD_OutUDec4(LightData,         LIGHTCOLOR);
@@ -387,7 +414,7 @@ void Task5(void){int32_t soundSum;
       BSP_LCD_SetCursor(0, 12); BSP_LCD_OutUDec4(LostTask1Data, BSP_LCD_Color565(255, 0, 0));
     }
 //end of debug code
-    OS_Signal(&LCDmutex);
+    OS_Unlock(&LCDmutex);
   }
 }
 /* ****************************************** */
@@ -402,19 +429,20 @@ void Task5(void){int32_t soundSum;
 // Outputs: none
 void Task6(void){ uint32_t lightData;
   int done;
+  OS_SetDeadline(800); // EDF mode: done before the next reading
   while(1){
     TExaS_Task6();     // records system time in array, toggles virtual logic analyzer
     Profile_Toggle6(); // viewed by the logic analyzer to know Task6 started
 
-    OS_Wait(&I2Cmutex);
+    OS_Lock(&I2Cmutex);
     BSP_LightSensor_Start();
-    OS_Signal(&I2Cmutex);
+    OS_Unlock(&I2Cmutex);
     done = 0;
     OS_Sleep(800);     // waits about 0.8 sec
     while(done == 0){
-      OS_Wait(&I2Cmutex);
+      OS_Lock(&I2Cmutex);
       done = BSP_LightSensor_End(&lightData);
-      OS_Signal(&I2Cmutex);
+      OS_Unlock(&I2Cmutex);
     }
     LightData = lightData/100;
   }
@@ -426,15 +454,26 @@ void Task6(void){ uint32_t lightData;
 //---------------- Task7 dummy function ----------------
 // *********Task7*********
 // Main thread scheduled by OS round robin preemptive scheduler
-// Task7 does nothing but never blocks or sleeps
+// Task7 has no timing requirement; every 100 ms it copies the
+// run time and stack usage of one thread and the CPU load, so
+// the eight entries of Stats and StackUsage are refreshed every
+// 800 ms. A StackUsage near 100 means that thread needs a bigger
+// stack, and -2 means it overflowed. The kernel's idle
+// thread runs when nothing else is ready, so Task7 sleeps.
 // Inputs:  none
 // Outputs: none
 uint32_t Count7;
+threadStatsType Stats[8]; // view in the debugger
+uint32_t Load;            // CPU load in 0.1%, view in the debugger
+int32_t StackUsage[8];    // words of stack each thread used, view in the debugger
 void Task7(void){
   Count7 = 0;
   while(1){
     Count7++;
-    WaitForInterrupt();
+    OS_GetThreadStats(Count7&7, &Stats[Count7&7]);
+    StackUsage[Count7&7] = OS_StackUsage(Count7&7);
+    Load = OS_CPULoad();
+    OS_Sleep(100);
   }
 }
 /* ****************************************** */
@@ -472,18 +511,27 @@ int main_real(void){
   BSP_TempSensor_Init();
   Time = 0;
   OS_InitSemaphore(&NewData, 0);  // 0 means no data
-  OS_InitSemaphore(&LCDmutex, 1); // 1 means free
-  OS_InitSemaphore(&I2Cmutex, 1); // 1 means free
+  OS_InitMutex(&LCDmutex);        // free
+  OS_InitMutex(&I2Cmutex);        // free
   OS_InitSemaphore(&TakeSoundData,0);
-  OS_InitSemaphore(&ADCmutex,1);
   BSP_Microphone_Init();
+  OS_Ring_Init(&SoundRing, SoundBuffer, sizeof(uint16_t), SOUNDDEPTH, NULL);
   BSP_Accelerometer_Init();
   OS_InitSemaphore(&TakeAccelerationData,0);
-  OS_FIFO_Init();                 // initialize FIFO used to send data between Task1 and Task2
-  OS_AddThreads(&Task0,0, &Task1,1, &Task2,2, &Task3,3, 
-	              &Task4,3, &Task5,3, &Task6,3, &Task7,4);
-	OS_PeriodTrigger0_Init(&TakeSoundData,1);  // every 1 ms
-	OS_PeriodTrigger1_Init(&TakeAccelerationData,100); //every 100ms
+  OS_Queue_Init(&AccQueue, AccBuffer, sizeof(uint32_t), ACCDEPTH); // data from Task1 to Task2
+  // eight 100-word stacks fill the 800-word stack pool, Task7 calls
+  // OS_GetThreadStats and OS_CPULoad so it needs as much as the others
+  OS_AddThread(&Task0,0,100);
+  OS_AddThread(&Task1,1,100);
+  OS_AddThread(&Task2,2,100);
+  OS_AddThread(&Task3,3,100);
+  OS_AddThread(&Task4,3,100);
+  OS_AddThread(&Task5,3,100);
+  OS_AddThread(&Task6,3,100);
+  OS_AddThread(&Task7,4,100);
+	OS_Sampler_Init(&SampleSound);               // every 1 ms, at priority 0
+	OS_PeriodTrigger_Init(&TakeSoundData,1,10);  // every 1 ms, once all threads ran
+	OS_PeriodTrigger_Init(&TakeAccelerationData,100,15); //every 100ms
   // when grading change 1000 to 4-digit number from edX
   TExaS_Init(GRADER, 8864  );          // initialize the Lab 4 grader
 //  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
@@ -524,7 +572,7 @@ int n;             // loop counter
 // Remember that you must have exactly one main() function, so
 // to work on this step, you must rename all other main()
 // functions in this file.
-int32_t sAB,sCD,sEF;
+semaType sAB,sCD,sEF;
 int32_t CountA,CountB,CountC,CountD,CountE,CountF,CountG,CountH;
 void TaskA(void){ // producer highest priority
   CountA = 0;
@@ -613,8 +661,7 @@ int main_step1(void){
 /* ****************************************** */
 
 //---------------- Step 2 ----------------
-// Step 2 id to extend the OS to implement OS_PeriodTrigger0_Init
-// and OS_PeriodTrigger1_Init.
+// Step 2 id to extend the OS to implement OS_PeriodTrigger_Init.
 // Task   Type           When to Run
 // TaskI  data producer  periodically every 20 ms(timer)
 // TaskJ  data consumer  after TaskI finishes
@@ -627,8 +674,8 @@ int main_step1(void){
 // Remember that you must have exactly one main() function, so
 // to work on this step, you must rename all other main()
 // functions in this file.
-int32_t sIJ,sKL,sMN;
-int32_t sI,sK;
+semaType sIJ,sKL,sMN;
+semaType sI,sK;
 int32_t CountI,CountJ,CountK,CountL,CountM,CountN,CountO,CountP;
 void TaskI(void){ // producer highest priority
   CountI = 0;
@@ -708,8 +755,8 @@ int main_step2(void){
   OS_InitSemaphore(&sIJ, 0);
   OS_InitSemaphore(&sKL, 0);
   OS_InitSemaphore(&sMN, 0);
-	OS_PeriodTrigger0_Init(&sI,20);  // every 20 ms
-	OS_PeriodTrigger1_Init(&sK,50);  // every 50ms
+	OS_PeriodTrigger_Init(&sI,20,10);  // every 20 ms
+	OS_PeriodTrigger_Init(&sK,50,15);  // every 50ms, never with sI
   OS_AddThreads(&TaskI,0, &TaskJ,1, &TaskK,2, &TaskL,3,
    	&TaskM,4, &TaskN,5, &TaskO,6, &TaskP,7);
   TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 grader
@@ -735,8 +782,8 @@ int main_step2(void){
 // Remember that you must have exactly one main() function, so
 // to work on this step, you must rename all other main()
 // functions in this file.
-int32_t sQR;
-int32_t sQ;
+semaType sQR;
+semaType sQ;
 int32_t CountQ,CountR;
 void TaskQ(void){ // producer
   CountQ = 0;
@@ -756,7 +803,6 @@ void TaskR(void){ // consumer
     Profile_Toggle5();
     CountR++;
 		OS_Sleep(10);
-		OS_EdgeTrigger_Restart();
   }
 }
 int main(void){
@@ -768,8 +814,8 @@ int main(void){
   OS_InitSemaphore(&sIJ, 0);
   OS_InitSemaphore(&sKL, 0);
   OS_InitSemaphore(&sQR, 0);
-	OS_PeriodTrigger0_Init(&sI,50);   // every 50 ms
-	OS_PeriodTrigger1_Init(&sK,200);  // every 200ms
+	OS_PeriodTrigger_Init(&sI,50,10);   // every 50 ms
+	OS_PeriodTrigger_Init(&sK,200,35);  // every 200ms, never with sI
 	OS_EdgeTrigger_Init(&sQ,2);
   OS_AddThreads(&TaskI,0, &TaskJ,1, &TaskK,2, &TaskL,3,
    	&TaskQ,4, &TaskR,5, &TaskO,6, &TaskP,7);
@@ -781,3 +827,1190 @@ int main(void){
 /* ****************************************** */
 /*          End of Step 3 Section             */
 /* ****************************************** */
+
+//---------------- Scheduler benchmark ----------------
+// Measures the number of bus cycles one call to Scheduler takes,
+// using the DWT cycle counter, with 1, 8 and 16 threads spread
+// over four priorities. The scheduler finds the highest ready
+// priority with CLZ, so SchedMax should be the same in all three
+// columns. View the results in the debugger.
+// Uses the Step 1 threads TaskA-TaskH twice, with small stacks,
+// but never launches them.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+void Scheduler(void);         // in os.c, normally called from PendSV_Handler
+// ------------CycleCounter_Init------------
+// Start the DWT cycle counter, which counts every bus cycle.
+// Input: none
+// Output: none
+void CycleCounter_Init(void){
+  DEMCR |= 0x01000000;        // enable DWT
+  DWTCYCCNT = 0;
+  DWTCTRL |= 0x00000001;      // enable cycle counter
+}
+#define SCHEDRUNS 1000        // number of calls measured per thread count
+#define SCHEDSIZES 3          // number of thread counts measured
+const uint32_t SchedThreads[SCHEDSIZES] = {1, 8, 16};
+const uint32_t SchedPriority[4] = {3, 11, 19, 27};
+void (*const SchedTask[8])(void) = {
+  &TaskA, &TaskB, &TaskC, &TaskD, &TaskE, &TaskF, &TaskG, &TaskH};
+uint32_t SchedOverhead;       // cycles to read DWTCYCCNT twice
+uint32_t SchedMin[SCHEDSIZES],SchedMax[SCHEDSIZES]; // cycles for one call to Scheduler
+uint32_t SchedTotal[SCHEDSIZES]; // cycles for all SCHEDRUNS calls
+int main_schedbench(void){
+  uint32_t start,elapsed,added;
+  int i,n;
+  OS_Init();                  // interrupts stay disabled
+  CycleCounter_Init();
+  start = DWTCYCCNT;
+  SchedOverhead = DWTCYCCNT - start;
+  added = 0;
+  for(n=0; n<SCHEDSIZES; n=n+1){
+    while(added < SchedThreads[n]){ // 16 threads in 640 words of stack
+      OS_AddThread(SchedTask[added&7],SchedPriority[added&3],40);
+      added = added + 1;
+    }
+    SchedMin[n] = 0xFFFFFFFF;
+    SchedMax[n] = 0;
+    SchedTotal[n] = 0;
+    for(i=0; i<SCHEDRUNS; i=i+1){
+      start = DWTCYCCNT;
+      Scheduler();            // picks the next thread at the highest priority
+      elapsed = DWTCYCCNT - start - SchedOverhead;
+      if(elapsed < SchedMin[n]){
+        SchedMin[n] = elapsed;
+      }
+      if(elapsed > SchedMax[n]){
+        SchedMax[n] = elapsed;
+      }
+      SchedTotal[n] = SchedTotal[n] + elapsed;
+    }
+  }
+  while(1){};                 // view SchedMin, SchedMax, SchedTotal/SCHEDRUNS
+}
+/* ****************************************** */
+/*      End of Scheduler benchmark Section    */
+/* ****************************************** */
+
+//---------------- Semaphore benchmark ----------------
+// Measures the worst case time OS_Signal runs with interrupts
+// disabled, using the DWT cycle counter. Seven copies of
+// TaskWaiter block on sBench in the order they were added,
+// and TaskSignaler wakes them one at a time. Before each
+// semaphore had its own list of blocked threads, OS_Signal
+// searched the TCB ring starting at RunPt->next, so waking the
+// thread just before the signaler visited every TCB. Now it
+// takes the head of the list, so the time is the same for
+// every thread and every thread count. Threads wake up in the
+// order they blocked. View the results in the debugger.
+// OS_Signal runs with the kernel ceiling raised, so SignalMax is
+// the worst case time it holds off interrupts. To compare with
+// the old search, build os.c once with SEMARING 1 (Options for
+// Target, C/C++, Define: SEMARING=1) and once without, and note
+// SignalMax from each run.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+semaType sBench;
+uint32_t SignalOverhead;      // cycles to read DWTCYCCNT twice
+uint32_t SignalMax;           // worst case cycles in OS_Signal that woke a thread
+uint32_t SignalCount;         // number of measured calls
+uint32_t CountWaiter;
+void TaskWaiter(void){        // seven copies, higher priority than TaskSignaler
+  while(1){
+    OS_Wait(&sBench);         // signaled by TaskSignaler
+    CountWaiter++;
+  }
+}
+void TaskSignaler(void){uint32_t start,elapsed;
+  SignalMax = 0;
+  SignalCount = 0;
+  while(1){
+    Profile_Toggle0();
+    DisableInterrupts();      // no interrupt adds to the measured time
+    start = DWTCYCCNT;
+    OS_Signal(&sBench);       // wakes the longest blocked TaskWaiter
+    elapsed = DWTCYCCNT - start - SignalOverhead;
+    EnableInterrupts();
+    if(elapsed > SignalMax){
+      SignalMax = elapsed;
+    }
+    SignalCount++;
+    OS_Suspend();             // let the TaskWaiter run and block again
+  }
+}
+int main_semabench(void){uint32_t start;
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  CycleCounter_Init();
+  start = DWTCYCCNT;
+  SignalOverhead = DWTCYCCNT - start;
+  OS_InitSemaphore(&sBench, 0);
+  OS_AddThreads(&TaskWaiter,0, &TaskWaiter,0, &TaskWaiter,0, &TaskWaiter,0,
+   	&TaskWaiter,0, &TaskWaiter,0, &TaskWaiter,0, &TaskSignaler,1);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*      End of Semaphore benchmark Section    */
+/* ****************************************** */
+
+//---------------- Priority inheritance test ----------------
+// Shows that the time a high priority thread waits for a mutex
+// is bounded by how long a low priority thread holds it, even
+// when a medium priority thread wants the processor for longer.
+// Task   Priority  Purpose
+// TaskHi    0      every 7 ms locks PImutex, measures cycles blocked
+// TaskMed   1      every 10 ms computes for about 5 ms, no mutex
+// TaskLo    2      always locks PImutex and holds it about 1 ms
+// TaskLo inherits priority 0 while TaskHi waits, so TaskMed can
+// not run in between and PIBlockMax stays near 1 ms of cycles.
+// With a semaphore instead of a mutex, TaskMed would preempt
+// TaskLo and TaskHi could wait about 6 ms.
+// View the results in the debugger.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+mutexType PImutex;
+uint32_t PIOverhead;          // cycles to read DWTCYCCNT twice
+uint32_t PIBlockMax;          // worst case cycles TaskHi waited in OS_Lock
+uint32_t PICount;             // number of times TaskHi got the mutex
+uint32_t CountMed,CountLo;
+// ------------Spin------------
+// Compute without blocking, about 1 ms for every 16000 loops at 80 MHz
+// Input: number of loops
+// Output: none
+void Spin(uint32_t n){volatile uint32_t i;
+  for(i=0; i<n; i=i+1){};
+}
+void TaskHi(void){uint32_t start,elapsed;
+  PIBlockMax = 0;
+  PICount = 0;
+  while(1){
+    OS_Sleep(7);
+    Profile_Toggle0();
+    start = DWTCYCCNT;
+    OS_Lock(&PImutex);        // may wait for TaskLo
+    elapsed = DWTCYCCNT - start - PIOverhead;
+    OS_Unlock(&PImutex);
+    if(elapsed > PIBlockMax){
+      PIBlockMax = elapsed;
+    }
+    PICount++;
+  }
+}
+void TaskMed(void){
+  while(1){
+    OS_Sleep(10);
+    Profile_Toggle1();
+    Spin(5*16000);            // about 5 ms
+    CountMed++;
+  }
+}
+void TaskLo(void){
+  while(1){
+    OS_Lock(&PImutex);
+    Profile_Toggle2();
+    Spin(16000);              // about 1 ms holding the mutex
+    OS_Unlock(&PImutex);
+    CountLo++;
+  }
+}
+int main_pitest(void){uint32_t start;
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  CycleCounter_Init();
+  start = DWTCYCCNT;
+  PIOverhead = DWTCYCCNT - start;
+  OS_InitMutex(&PImutex);
+  OS_AddThread(&TaskHi,0,64);
+  OS_AddThread(&TaskMed,1,64);
+  OS_AddThread(&TaskLo,2,64);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*  End of Priority inheritance test Section  */
+/* ****************************************** */
+
+//---------------- Event flags test ----------------
+// Shows one thread serving several event sources with an event
+// flag group, where each source would otherwise need its own
+// thread blocked on its own semaphore, and its own stack.
+// Source       Flag         How often
+// periodic     EVENT_FAST   every 10 ms, OS_PeriodFlags_Init
+// periodic     EVENT_SLOW   every 25 ms, OS_PeriodFlags_Init
+// TaskMaker    EVENT_DATA   every 7 ms, OS_SetFlags from a thread
+// TaskServer   EVENT_HALF   every second EVENT_FAST
+// Task        Priority  Waits for
+// TaskServer     1      any of EVENT_FAST, EVENT_DATA, and clears it
+// TaskBoth       2      all of EVENT_SLOW and EVENT_HALF
+// TaskMaker      3      sleeps
+// After one second FastCount is about 100, DataCount about 140
+// and BothCount about 40, since a 20 ms EVENT_HALF is waiting
+// whenever EVENT_SLOW is set. View the results in the debugger.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+#define EVENT_FAST 0x01
+#define EVENT_SLOW 0x02
+#define EVENT_DATA 0x04
+#define EVENT_HALF 0x08
+flagsType Events;
+uint32_t FastCount,DataCount,BothCount;
+void TaskServer(void){uint32_t got;
+  while(1){
+    got = OS_WaitFlags(&Events, EVENT_FAST|EVENT_DATA, FLAGS_ANY, 1);
+    Profile_Toggle0();
+    if(got&EVENT_FAST){
+      FastCount++;
+      if((FastCount&1) == 0){
+        OS_SetFlags(&Events, EVENT_HALF);
+      }
+    }
+    if(got&EVENT_DATA){
+      DataCount++;
+    }
+  }
+}
+void TaskBoth(void){
+  while(1){
+    OS_WaitFlags(&Events, EVENT_SLOW|EVENT_HALF, FLAGS_ALL, 1);
+    Profile_Toggle1();
+    BothCount++;
+  }
+}
+void TaskMaker(void){
+  while(1){
+    OS_Sleep(7);
+    Profile_Toggle2();
+    OS_SetFlags(&Events, EVENT_DATA);
+  }
+}
+int main_flagtest(void){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  OS_InitFlags(&Events, 0);
+  OS_PeriodFlags_Init(&Events, EVENT_FAST, 10, 1);
+  OS_PeriodFlags_Init(&Events, EVENT_SLOW, 25, 6);
+  OS_AddThread(&TaskServer,1,64);
+  OS_AddThread(&TaskBoth,2,64);
+  OS_AddThread(&TaskMaker,3,64);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*        End of Event flags test Section     */
+/* ****************************************** */
+
+//---------------- Message queue test ----------------
+// Two pipelines, each with its own queue sized for its data.
+// Task         Priority  Purpose
+// TaskSampler     0      every 1 ms puts a 16-bit sample, never waits
+// TaskFrame       1      gets 10 samples at a time, checks their
+//                        order, puts a frame summary and may wait
+// TaskReport      2      gets 2 frames at a time
+// After one second FramesDone is about 100 and QueueErrors and
+// SampleQueue.lost stay 0. View the results in the debugger.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+#define SAMPLEDEPTH 32
+#define FRAMELENGTH 10
+struct frame {
+  uint16_t first;             // sequence number of the first sample
+  uint32_t sum;               // sum of the samples
+};
+semaType TakeSample;
+queueType SampleQueue;
+uint16_t SampleBuffer[SAMPLEDEPTH];
+queueType FrameQueue;
+struct frame FrameBuffer[4];
+uint32_t QueueErrors;         // samples out of order
+uint32_t FramesDone;
+void TaskSampler(void){uint16_t sample = 0;
+  while(1){
+    OS_Wait(&TakeSample);
+    Profile_Toggle0();
+    OS_Queue_Put(&SampleQueue, &sample, 0); // full is counted in SampleQueue.lost
+    sample++;
+  }
+}
+void TaskFrame(void){uint16_t samples[FRAMELENGTH];
+  uint16_t expected = 0;
+  struct frame f;
+  int i;
+  while(1){
+    OS_Queue_GetBatch(&SampleQueue, samples, FRAMELENGTH, 1);
+    Profile_Toggle1();
+    f.first = samples[0];
+    f.sum = 0;
+    for(i=0; i<FRAMELENGTH; i=i+1){
+      if(samples[i] != expected){
+        QueueErrors++;
+      }
+      expected = samples[i]+1;
+      f.sum = f.sum+samples[i];
+    }
+    OS_Queue_Put(&FrameQueue, &f, 1);
+  }
+}
+void TaskReport(void){struct frame frames[2];
+  while(1){
+    OS_Queue_GetBatch(&FrameQueue, frames, 2, 1);
+    Profile_Toggle2();
+    FramesDone = FramesDone+2;
+  }
+}
+int main_queuetest(void){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  OS_InitSemaphore(&TakeSample, 0);
+  OS_Queue_Init(&SampleQueue, SampleBuffer, sizeof(uint16_t), SAMPLEDEPTH);
+  OS_Queue_Init(&FrameQueue, FrameBuffer, sizeof(struct frame), 4);
+  OS_AddThread(&TaskSampler,0,64);
+  OS_AddThread(&TaskFrame,1,64);
+  OS_AddThread(&TaskReport,2,64);
+  OS_PeriodTrigger_Init(&TakeSample, 1, 1);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*      End of Message queue test Section     */
+/* ****************************************** */
+
+//---------------- Semaphore timeout test ----------------
+// TaskSensor signals SensorReady every 20 ms, except that every
+// 10th reading it hangs for 200 ms. TaskWatcher waits at most
+// 50 ms, so it keeps running while the sensor hangs, and
+// TaskPoller takes Tokens with OS_TryWait without ever blocking.
+// Task         Priority  Purpose
+// TaskWatcher     1      OS_WaitTimeout(&SensorReady, 50)
+// TaskSensor      2      signals SensorReady and Tokens
+// TaskPoller      3      OS_TryWait(&Tokens) every 5 ms
+// After one second ReadyCount is about 26, TimeoutCount about 10,
+// and TokenCount plus EmptyCount is about 200.
+// WatchErrors counts a timeout that ended in less than 49 ms, or
+// a semaphore value that a timeout left wrong; it should stay 0.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+semaType SensorReady,Tokens;
+uint32_t ReadyCount,TimeoutCount,TokenCount,EmptyCount,WatchErrors;
+void TaskWatcher(void){uint32_t start;
+  while(1){
+    start = DWTCYCCNT;
+    if(OS_WaitTimeout(&SensorReady, 50)){
+      Profile_Toggle0();
+      ReadyCount++;
+    } else{
+      Profile_Toggle1();
+      TimeoutCount++;
+      if((DWTCYCCNT-start < 49*(BSP_Clock_GetFreq()/1000))|| // first tick may be short
+         (SensorReady.value != 0)){
+        WatchErrors++;
+      }
+    }
+  }
+}
+void TaskSensor(void){uint32_t n = 0;
+  while(1){
+    n++;
+    OS_Sleep((n%10 == 0) ? 200 : 20);
+    Profile_Toggle2();
+    OS_Signal(&SensorReady);
+    OS_Signal(&Tokens);
+  }
+}
+void TaskPoller(void){
+  while(1){
+    OS_Sleep(5);
+    if(OS_TryWait(&Tokens)){
+      TokenCount++;
+    } else{
+      EmptyCount++;
+    }
+  }
+}
+int main_timeouttest(void){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  OS_InitSemaphore(&SensorReady, 0);
+  OS_InitSemaphore(&Tokens, 0);
+  OS_AddThread(&TaskWatcher,1,64);
+  OS_AddThread(&TaskSensor,2,64);
+  OS_AddThread(&TaskPoller,3,64);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*     End of Semaphore timeout test Section  */
+/* ****************************************** */
+
+//---------------- Edge trigger test ----------------
+// Both buttons on Port D, handled by the kernel's edge triggers.
+// Each touch bounces, and the kernel ignores a pin for its
+// debounce time after an edge, then rearms it without any help
+// from the threads.
+// Pin                   Edge     Debounce  Wakes up
+// button1 J4.33, PD6    falling  20 ms     TaskTouch1, semaphore
+// button2 J4.32, PD7    falling  20 ms     TaskTouch2, event flag
+// Task         Priority  Purpose
+// TaskTouch1      1      counts touches of button1
+// TaskTouch2      1      counts touches of button2
+// TaskBusy        2      never blocks, so the edges arrive under load
+// Touch1Count and Touch2Count should go up by one per touch;
+// ShortTouches counts touches less than 20 ms after the one
+// before, which the debounce should make impossible.
+// View the results in the debugger.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+#define EVENT_BUTTON2 0x01
+semaType Touch1;
+flagsType Buttons;
+uint32_t Touch1Count,Touch2Count,ShortTouches;
+volatile uint32_t BusyCount;
+void TaskTouch1(void){uint32_t last,now;
+  last = DWTCYCCNT;
+  while(1){
+    OS_Wait(&Touch1);
+    now = DWTCYCCNT;
+    Profile_Toggle0();
+    if((Touch1Count > 0)&&(now-last < 20*(BSP_Clock_GetFreq()/1000))){
+      ShortTouches++;
+    }
+    last = now;
+    Touch1Count++;
+  }
+}
+void TaskTouch2(void){
+  while(1){
+    OS_WaitFlags(&Buttons, EVENT_BUTTON2, FLAGS_ANY, 1);
+    Profile_Toggle1();
+    Touch2Count++;
+  }
+}
+void TaskBusy(void){
+  while(1){
+    BusyCount++;
+  }
+}
+int main_edgetest(void){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  OS_InitSemaphore(&Touch1, 0);
+  OS_InitFlags(&Buttons, 0);
+  OS_Edge_Init(EDGE_PORTD, 6, EDGE_FALLING, 20, &Touch1, NULL, 0, 3);
+  OS_Edge_Init(EDGE_PORTD, 7, EDGE_FALLING, 20, NULL, &Buttons, EVENT_BUTTON2, 3);
+  OS_AddThread(&TaskTouch1,1,64);
+  OS_AddThread(&TaskTouch2,1,64);
+  OS_AddThread(&TaskBusy,2,64);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*        End of Edge trigger test Section    */
+/* ****************************************** */
+
+//---------------- Software timer test ----------------
+// Timed work without a thread or a hardware timer per job.
+// Timer        Kind         Callback does
+// TenTimer     every 10 ms  counts, checks the time since the last call
+// ChainTimer   one-shot     counts, restarts itself for 7 ms later
+// BlinkTimer   every 250 ms blinks the RGB LED
+// FastTimer    every 3 ms   counts, stopped by TaskTimers
+// Task         Priority  Purpose
+// TaskTimers      1      stops FastTimer after 100 ms, then checks
+//                        once a second that the counts agree
+// TaskSpin        2      never blocks
+// After one second TenCount is about 100, ChainCount about 142,
+// FastCount stays at 33, and TimerErrors stays 0. TenJitter is the
+// largest error of the 10 ms period in bus cycles.
+// View the results in the debugger.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+timerType TenTimer,ChainTimer,BlinkTimer,FastTimer;
+uint32_t TenCount,ChainCount,BlinkCount,FastTimerCount,TimerErrors;
+uint32_t TenLast,TenJitter;
+volatile uint32_t SpinCount;
+void TenTick(void){uint32_t now,error;
+  now = DWTCYCCNT;
+  if(TenCount > 0){
+    error = now-TenLast;
+    if(error > 10*(BSP_Clock_GetFreq()/1000)){
+      error = error-10*(BSP_Clock_GetFreq()/1000);
+    } else{
+      error = 10*(BSP_Clock_GetFreq()/1000)-error;
+    }
+    if(error > TenJitter){
+      TenJitter = error;
+    }
+  }
+  TenLast = now;
+  TenCount++;
+}
+void ChainTick(void){
+  ChainCount++;
+  OS_Timer_Start(&ChainTimer, &ChainTick, 7, 0);
+}
+void BlinkTick(void){
+  BlinkCount++;
+  if(BlinkCount&1){
+    BSP_RGB_Set(0, 0, 512);
+  } else{
+    BSP_RGB_Set(0, 0, 0);
+  }
+}
+void FastTick(void){
+  FastTimerCount++;
+}
+void TaskTimers(void){uint32_t seconds = 0;
+  OS_Sleep(100);
+  if(OS_Timer_Stop(&FastTimer) == 0){
+    TimerErrors++;              // should still be running
+  }
+  while(1){
+    OS_Sleep(1000);
+    seconds++;
+    Profile_Toggle0();
+    if((FastTimerCount != 33)||(FastTimer.active)||
+       (TenCount+1 < 100*seconds)||(ChainCount+1 < 140*seconds)){
+      TimerErrors++;
+    }
+  }
+}
+void TaskSpin(void){
+  while(1){
+    SpinCount++;
+  }
+}
+int main_timertest(void){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  BSP_RGB_Init(0, 0, 0);
+  OS_Timer_Start(&TenTimer, &TenTick, 0, 10);
+  OS_Timer_Start(&ChainTimer, &ChainTick, 7, 0);
+  OS_Timer_Start(&BlinkTimer, &BlinkTick, 0, 250);
+  OS_Timer_Start(&FastTimer, &FastTick, 0, 3);
+  OS_AddThread(&TaskTimers,1,64);
+  OS_AddThread(&TaskSpin,2,64);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*      End of Software timer test Section    */
+/* ****************************************** */
+
+//---------------- Ring buffer test ----------------
+// A 1 kHz timer ISR samples the microphone into a lock-free ring,
+// which never disables interrupts, and a thread blocks until
+// there is data. The ISR signals the ring's semaphore only when
+// the thread is blocked, about once per sample here since the
+// thread keeps up.
+// Task/ISR     Priority  Purpose
+// MicISR       1 (NVIC)  every 1 ms, puts one 16-bit sample
+// TaskMic      0         gets samples, sums 100 at a time
+// TaskIdle     1         counts, never blocks
+// After one second MicSamples is about 1000, MicRing.lost is 0
+// and MicPutMax is the worst case cycles in OS_Ring_Put.
+// View the results in the debugger.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+#define MICDEPTH 64
+ringType MicRing;
+uint16_t MicBuffer[MICDEPTH];
+semaType MicReady;
+uint32_t MicSamples;          // samples taken out of the ring
+uint32_t MicSum;              // sum of the last 100 samples
+uint32_t MicPutMax;           // worst case cycles in OS_Ring_Put
+uint32_t CountIdle;
+void MicISR(void){uint16_t sample;
+  uint32_t start,elapsed;
+  BSP_Microphone_Input(&sample);
+  start = DWTCYCCNT;
+  OS_Ring_Put(&MicRing, &sample); // full is counted in MicRing.lost
+  elapsed = DWTCYCCNT - start;
+  if(elapsed > MicPutMax){
+    MicPutMax = elapsed;
+  }
+}
+void TaskMic(void){uint16_t sample;
+  uint32_t sum = 0;
+  while(1){
+    OS_Ring_Get(&MicRing, &sample, 1);
+    Profile_Toggle0();
+    sum = sum+sample;
+    MicSamples++;
+    if((MicSamples%100) == 0){
+      MicSum = sum;
+      sum = 0;
+    }
+  }
+}
+void TaskIdle(void){
+  while(1){
+    CountIdle++;
+  }
+}
+int main_ringtest(void){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  CycleCounter_Init();
+  BSP_Microphone_Init();
+  OS_Ring_Init(&MicRing, MicBuffer, sizeof(uint16_t), MICDEPTH, &MicReady);
+  OS_AddThread(&TaskMic,0,64);
+  OS_AddThread(&TaskIdle,1,64);
+  BSP_PeriodicTask_Init(&MicISR, 1000, 1);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*       End of Ring buffer test Section      */
+/* ****************************************** */
+
+//---------------- Work queue test ----------------
+// A 2 kHz timer ISR plays the part of a serial port receiving
+// 8-byte messages from the application processor. It only stores
+// each byte, and after the last byte of a message posts a job to
+// the kernel's work queue, which checks the message's CRC and
+// sequence number in thread context.
+// Task/ISR     Priority  Purpose
+// MsgISR       2 (NVIC)  every 0.5 ms, stores one byte
+// ParseMsg     1 (work)  checks one message, a few hundred cycles
+// TaskMsgCheck 1         once a second checks the counts
+// TaskMsgSpin  2         never blocks
+// After one second MsgParsed is about 250, MsgErrors is 0 and
+// MsgISRMax is the worst case cycles in MsgISR, including OS_Defer.
+// View the results in the debugger.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+#define MSGLENGTH  8          // bytes per message, the last is the CRC
+#define MSGBUFFERS 4          // messages that can wait to be parsed
+uint8_t MsgBuffer[MSGBUFFERS][MSGLENGTH];
+uint32_t MsgByte;             // bytes received
+uint32_t MsgParsed,MsgErrors;
+uint32_t MsgISRMax;           // worst case cycles in MsgISR
+volatile uint32_t MsgSpinCount;
+// ------------Crc8------------
+// CRC-8 (polynomial 0x07) of a block of bytes, one bit at a time
+// Input: bytes, number of bytes
+// Output: CRC
+uint8_t Crc8(const uint8_t *pt, uint32_t n){
+  uint8_t crc = 0;
+  uint32_t i;
+  while(n){
+    crc = crc^(*pt);
+    for(i=0; i<8; i++){
+      if(crc&0x80){
+        crc = (crc<<1)^0x07;
+      } else{
+        crc = crc<<1;
+      }
+    }
+    pt++; n--;
+  }
+  return crc;
+}
+void ParseMsg(uint32_t buffer){
+  static uint8_t expect = 0;  // sequence number of the next message
+  uint8_t *msg = MsgBuffer[buffer];
+  if((Crc8(msg, MSGLENGTH-1) != msg[MSGLENGTH-1])||(msg[0] != expect)){
+    MsgErrors++;
+  }
+  expect = msg[0]+1;
+  MsgParsed++;
+}
+void MsgISR(void){uint32_t start,elapsed;
+  uint32_t i = MsgByte%MSGLENGTH;
+  uint32_t m = MsgByte/MSGLENGTH;
+  uint8_t *msg = MsgBuffer[m%MSGBUFFERS];
+  start = DWTCYCCNT;
+  if(i == 0){
+    msg[0] = m;               // sequence number
+  } else if(i < MSGLENGTH-1){
+    msg[i] = m*i;             // payload
+  } else{
+    msg[i] = Crc8(msg, MSGLENGTH-1); // the sender's work, not timed below
+    start = DWTCYCCNT;
+    OS_Defer(&ParseMsg, m%MSGBUFFERS);
+  }
+  MsgByte++;
+  elapsed = DWTCYCCNT - start;
+  if(elapsed > MsgISRMax){
+    MsgISRMax = elapsed;
+  }
+}
+void TaskMsgCheck(void){uint32_t seconds = 0;
+  while(1){
+    OS_Sleep(1000);
+    seconds++;
+    Profile_Toggle0();
+    if(MsgParsed+2 < 250*seconds){
+      MsgErrors++;            // jobs lost or not run
+    }
+  }
+}
+void TaskMsgSpin(void){
+  while(1){
+    MsgSpinCount++;
+  }
+}
+int main_defertest(void){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  CycleCounter_Init();
+  OS_AddThread(&TaskMsgCheck,1,64);
+  OS_AddThread(&TaskMsgSpin,2,64);
+  BSP_PeriodicTask_Init(&MsgISR, 2000, 2);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*        End of Work queue test Section      */
+/* ****************************************** */
+
+//---------------- Time slice test ----------------
+// Three threads at priority 2 never block, and take turns of 1, 2
+// and 4 time slices (OS_SetQuantum), so they get about 1/7, 2/7
+// and 4/7 of the processor. TaskPinger, also at priority 2, sleeps
+// 10 ms at a time; when it wakes up it waits at most one turn of
+// each of the others, 7 ms, however much they want to run.
+// Task         Priority  Purpose
+// TaskShare1      2      counts, 1 slice per turn
+// TaskShare2      2      counts, 2 slices per turn
+// TaskShare4      2      counts, 4 slices per turn
+// TaskPinger      2      sleeps 10 ms, measures how late it runs
+// TaskShares      1      once a second finds each share in 0.1%
+// After a few seconds Share is about {143,286,571} and PingLateMax
+// is less than 8000 us.
+// View the results in the debugger.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+uint32_t Share[3];            // TaskShare1, 2 and 4, in 0.1%
+uint32_t PingLateMax;         // us
+volatile uint32_t ShareCount[3];
+void TaskShare1(void){
+  OS_SetQuantum(1);
+  while(1){
+    ShareCount[0]++;
+  }
+}
+void TaskShare2(void){
+  OS_SetQuantum(2);
+  while(1){
+    ShareCount[1]++;
+  }
+}
+void TaskShare4(void){
+  OS_SetQuantum(4);
+  while(1){
+    ShareCount[2]++;
+  }
+}
+void TaskPinger(void){uint32_t start,elapsed;
+  uint32_t sleepCycles = 10*(BSP_Clock_GetFreq()/1000);
+  while(1){
+    start = DWTCYCCNT;
+    OS_Sleep(10);
+    elapsed = DWTCYCCNT - start;
+    Profile_Toggle1();
+    if((elapsed > sleepCycles)&&
+       ((elapsed-sleepCycles)/(BSP_Clock_GetFreq()/1000000) > PingLateMax)){
+      PingLateMax = (elapsed-sleepCycles)/(BSP_Clock_GetFreq()/1000000);
+    }
+  }
+}
+void TaskShares(void){threadStatsType stats;
+  uint64_t last[3] = {0,0,0};
+  uint64_t used[3],total;
+  uint32_t i;
+  while(1){
+    OS_Sleep(1000);
+    Profile_Toggle0();
+    total = 0;
+    for(i=0; i<3; i++){
+      OS_GetThreadStats(i, &stats);  // TaskShare1, 2 and 4 were added first
+      used[i] = stats.runCycles-last[i];
+      last[i] = stats.runCycles;
+      total = total+used[i];
+    }
+    for(i=0; i<3; i++){
+      Share[i] = total ? (uint32_t)(used[i]*1000/total) : 0;
+    }
+  }
+}
+int main_quantumtest(void){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  CycleCounter_Init();
+  OS_AddThread(&TaskShare1,2,64);
+  OS_AddThread(&TaskShare2,2,64);
+  OS_AddThread(&TaskShare4,2,64);
+  OS_AddThread(&TaskPinger,2,64);
+  OS_AddThread(&TaskShares,1,128);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*        End of Time slice test Section      */
+/* ****************************************** */
+
+//---------------- Sporadic server test ----------------
+// Button1 bounces with no debounce, so every touch is a storm of
+// five interrupts, and each one costs TaskButton 400 us of work
+// (think of an LCD redraw). TaskButton runs above TaskSound so a
+// touch is handled at once, but under a sporadic server of 250 us
+// every 2 ms: after that it drops to priority 3, below TaskSound,
+// which needs 300 us every 1 ms and must finish before the next
+// release. TaskSound never misses (SoundMisses stays 0) however
+// fast button1 is touched. main_stormtest runs the same threads
+// with no server; there TaskSound hardly runs at all once the
+// touches start.
+// Task/ISR     Priority  Purpose
+// GPIOPortD    2 (NVIC)  signals ButtonTouch on every edge of PD6
+// TaskButton   0 / 3     400 us per edge, served 250 us per 2 ms
+// TaskSound    1         every 1 ms, 300 us of work
+// TaskBack     4         counts, uses the time left over
+// View the results in the debugger: SoundJobs grows 1000 per s,
+// ButtonWork counts the edges handled, and ButtonServer.exhausted
+// the times the budget ran out.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+serverType ButtonServer;
+semaType ButtonTouch,SoundRelease;
+uint32_t ButtonWork,SoundJobs,SoundMisses;
+int ButtonServed;             // 1 runs TaskButton under ButtonServer
+volatile uint32_t BackCount;
+// ------------SpinUs------------
+// Keep the processor busy, standing in for real work
+// Input: number of us
+// Output: none
+void SpinUs(uint32_t us){uint32_t start;
+  start = DWTCYCCNT;
+  while((DWTCYCCNT - start) < us*(BSP_Clock_GetFreq()/1000000)){};
+}
+void TaskButton(void){
+  if(ButtonServed){
+    OS_Server_Init(&ButtonServer, 250, 2, 3);
+  }
+  while(1){
+    OS_Wait(&ButtonTouch);
+    SpinUs(400);
+    ButtonWork++;
+  }
+}
+void TaskSound(void){
+  while(1){
+    OS_Wait(&SoundRelease);
+    Profile_Toggle0();
+    SpinUs(300);
+    SoundJobs++;
+    while(OS_TryWait(&SoundRelease)){
+      SoundMisses++;          // a release came before this job was done
+    }
+  }
+}
+void TaskBack(void){
+  while(1){
+    BackCount++;
+  }
+}
+int ServerTest(int served){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  CycleCounter_Init();
+  ButtonServed = served;
+  OS_InitSemaphore(&ButtonTouch, 0);
+  OS_InitSemaphore(&SoundRelease, 0);
+  OS_Edge_Init(EDGE_PORTD, 6, EDGE_FALLING, 0, &ButtonTouch, NULL, 0, 2);
+  OS_PeriodTrigger_Init(&SoundRelease, 1, 0);
+  OS_AddThread(&TaskButton,0,64);
+  OS_AddThread(&TaskSound,1,64);
+  OS_AddThread(&TaskBack,4,64);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+int main_servertest(void){
+  return ServerTest(1);
+}
+int main_stormtest(void){
+  return ServerTest(0);
+}
+/* ****************************************** */
+/*     End of Sporadic server test Section    */
+/* ****************************************** */
+
+//---------------- Microsecond sleep test ----------------
+// TaskPace runs every 250 us with OS_SleepUntil, adding the period
+// to its wake up time instead of sleeping 250 us after it woke up,
+// so however late a wake up is the loop does not drift. TaskShort
+// sleeps 100 us at a time with OS_SleepUs, and TaskSlow uses the
+// 1 ms OS_Sleep next to them. Nothing else runs, so the processor
+// sleeps in the idle thread in between.
+// Task         Priority  Purpose
+// TaskPace        1      every 250 us, measures how late it woke up
+// TaskShort       2      sleeps 100 us, measures how long it slept
+// TaskSlow        3      every 10 ms, checks that TaskPace kept up
+// After one second PaceCount is 4000, PaceLateMax is a few us,
+// ShortMin is at least 100 and SleepErrors stays 0.
+// View the results in the debugger.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+uint32_t PaceCount,PaceLateMax;   // us
+uint32_t ShortCount,ShortMin,ShortMax;
+uint32_t SleepErrors;
+uint64_t PaceStart;
+void TaskPace(void){uint64_t next,now;
+  next = OS_TimeUs();
+  PaceStart = next;
+  while(1){
+    next = next+250;
+    OS_SleepUntil(next);
+    now = OS_TimeUs();
+    Profile_Toggle0();
+    if(now < next){
+      SleepErrors++;          // woke up early
+    } else if(now-next > PaceLateMax){
+      PaceLateMax = now-next;
+    }
+    PaceCount++;
+  }
+}
+void TaskShort(void){uint64_t start;
+  uint32_t slept;
+  ShortMin = 0xFFFFFFFF;
+  while(1){
+    start = OS_TimeUs();
+    OS_SleepUs(100);
+    slept = OS_TimeUs()-start;
+    Profile_Toggle1();
+    if(slept < ShortMin){
+      ShortMin = slept;
+    }
+    if(slept > ShortMax){
+      ShortMax = slept;
+    }
+    ShortCount++;
+  }
+}
+void TaskSlow(void){uint64_t elapsed;
+  while(1){
+    OS_Sleep(10);
+    elapsed = OS_TimeUs()-PaceStart;
+    if(PaceCount+2 < elapsed/250){
+      SleepErrors++;          // TaskPace fell behind
+    }
+  }
+}
+int main_sleeptest(void){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  OS_AddThread(&TaskPace,1,64);
+  OS_AddThread(&TaskShort,2,64);
+  OS_AddThread(&TaskSlow,3,64);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*     End of Microsecond sleep test Section  */
+/* ****************************************** */
+
+//---------------- EDF mutex test ----------------
+// Shows that in EDF mode the owner of a mutex inherits the
+// deadline of a thread blocked on it, whether the owner has a
+// deadline of its own or not. Build os.c with EDF 1 (Options
+// for Target, C/C++, Define: EDF=1), without it the threads run
+// at their fixed priorities like main_pitest.
+// Task       Deadline  Priority  Purpose
+// TaskEdfHi    3 ms       0      every 5 ms locks EDFmutex for 100 us
+// TaskEdfMed  10 ms       1      every 20 ms computes for 5 ms, no mutex
+// TaskEdfLo  100 ms       2      locks EDFmutex for 1.5 ms, sleeps 2 ms
+// TaskEdfBg    none       3      locks EDFmutex for 1.5 ms every 10 ms
+// TaskEdfMed is due before TaskEdfLo, and every thread with a
+// deadline runs before TaskEdfBg, so without inheritance
+// TaskEdfHi could wait 5 ms for the mutex and miss its deadline.
+// With it EdfWaitMax stays under 1.5 ms and EdfMisses stays 0.
+// View the results in the debugger.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+mutexType EDFmutex;
+uint32_t EdfWaitMax;          // worst case us TaskEdfHi waited in OS_Lock
+uint32_t EdfMisses;           // jobs of all threads that finished late
+uint32_t EdfHiCount,EdfMedCount,EdfLoCount,EdfBgCount;
+void TaskEdfHi(void){uint32_t wait;uint64_t start;
+  OS_SetDeadline(3);
+  while(1){
+    OS_Sleep(5);
+    Profile_Toggle0();
+    start = OS_TimeUs();
+    OS_Lock(&EDFmutex);       // may wait for TaskEdfLo or TaskEdfBg
+    wait = OS_TimeUs()-start;
+    SpinUs(100);
+    OS_Unlock(&EDFmutex);
+    if(wait > EdfWaitMax){
+      EdfWaitMax = wait;
+    }
+    EdfMisses = OS_DeadlineMisses();
+    EdfHiCount++;
+  }
+}
+void TaskEdfMed(void){
+  OS_SetDeadline(10);
+  while(1){
+    OS_Sleep(20);
+    Profile_Toggle1();
+    SpinUs(5000);
+    EdfMedCount++;
+  }
+}
+void TaskEdfLo(void){
+  OS_SetDeadline(100);
+  while(1){
+    OS_Lock(&EDFmutex);
+    Profile_Toggle2();
+    SpinUs(1500);             // holding the mutex at the next tick
+    OS_Unlock(&EDFmutex);
+    EdfLoCount++;
+    OS_Sleep(2);
+  }
+}
+void TaskEdfBg(void){
+  while(1){
+    OS_Sleep(10);
+    OS_Lock(&EDFmutex);
+    Profile_Toggle3();
+    SpinUs(1500);             // holding the mutex at the next tick
+    OS_Unlock(&EDFmutex);
+    EdfBgCount++;
+  }
+}
+int main_edftest(void){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  EdfWaitMax = 0;
+  EdfMisses = 0;
+  OS_InitMutex(&EDFmutex);
+  OS_AddThread(&TaskEdfHi,0,64);
+  OS_AddThread(&TaskEdfMed,1,64);
+  OS_AddThread(&TaskEdfLo,2,64);
+  OS_AddThread(&TaskEdfBg,3,64);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*          End of EDF mutex test Section     */
+/* ****************************************** */
+
+//---------------- Sampling jitter test ----------------
+// Compares how evenly spaced two 1 ms samples are. JitterISR runs
+// from the OS timer interrupt at priority 0 (OS_Sampler_Init),
+// which neither kernel critical sections nor other interrupts hold
+// off. TaskJitter is woken by OS_PeriodTrigger_Init, so it waits
+// for the kernel and for TaskLoadISR, which shares priority 1 with
+// the software interrupt that signals it.
+// Task/ISR     Priority  Purpose
+// JitterISR    0 (NVIC)  every 1 ms, records the time
+// TaskJitter      0      woken every 1 ms, records the time
+// TaskLoadISR  1 (NVIC)  every 1.4 ms, computes for about 200 us
+// TaskLoad        1      signals and takes a semaphore, never blocks
+// JitterISRMax and JitterThreadMax are the worst case distance in
+// us from 1 ms between two samples. On the board JitterISRMax
+// stays within a few us while JitterThreadMax reaches the 200 us
+// of TaskLoadISR. In HostSim, which moves time in 50 us steps,
+// JitterISRMax is 0 and JitterThreadMax is 50 or 100 us.
+// View the results in the debugger.
+// Remember that you must have exactly one main() function, so
+// to work on this step, you must rename all other main()
+// functions in this file.
+semaType JitterTrigger,LoadSema;
+uint32_t JitterPeriod;        // bus cycles in 1 ms
+uint32_t JitterISRMax,JitterThreadMax; // us
+uint32_t JitterISRCount,JitterThreadCount,LoadCount,LoadISRCount;
+// ------------Jitter------------
+// Distance in us between the time since the last sample and 1 ms
+// Input: time of this sample, pointer to time of the last sample
+// Output: distance in us, 0 for the first sample
+uint32_t Jitter(uint32_t now, uint32_t *lastPt){uint32_t elapsed;
+  elapsed = now - *lastPt;
+  *lastPt = now;
+  if(elapsed > JitterPeriod){
+    elapsed = elapsed - JitterPeriod;
+  } else{
+    elapsed = JitterPeriod - elapsed;
+  }
+  return elapsed/(JitterPeriod/1000);
+}
+void JitterISR(void){uint32_t jitter;
+  static uint32_t last;
+  jitter = Jitter(DWTCYCCNT, &last);
+  if((JitterISRCount > 0)&&(jitter > JitterISRMax)){
+    JitterISRMax = jitter;
+  }
+  JitterISRCount++;
+}
+void TaskJitter(void){uint32_t jitter;
+  uint32_t last = 0;
+  while(1){
+    OS_Wait(&JitterTrigger);  // signaled every 1 ms
+    jitter = Jitter(DWTCYCCNT, &last);
+    Profile_Toggle0();
+    if((JitterThreadCount > 0)&&(jitter > JitterThreadMax)){
+      JitterThreadMax = jitter;
+    }
+    JitterThreadCount++;
+  }
+}
+void TaskLoadISR(void){
+  Profile_Toggle1();
+  Spin(3200);                 // about 200 us
+  LoadISRCount++;
+}
+void TaskLoad(void){
+  while(1){
+    OS_Signal(&LoadSema);
+    OS_Wait(&LoadSema);
+    LoadCount++;
+  }
+}
+int main_jittertest(void){
+  OS_Init();
+  Profile_Init();  // initialize the 7 hardware profiling pins
+  CycleCounter_Init();
+  JitterPeriod = BSP_Clock_GetFreq()/1000;
+  JitterISRMax = JitterThreadMax = 0;
+  OS_InitSemaphore(&JitterTrigger, 0);
+  OS_InitSemaphore(&LoadSema, 0);
+  OS_AddThread(&TaskJitter,0,64);
+  OS_AddThread(&TaskLoad,1,64);
+  OS_Sampler_Init(&JitterISR);
+  OS_PeriodTrigger_Init(&JitterTrigger,1,0);
+  BSP_PeriodicTask_Init(&TaskLoadISR, 714, 1);
+  TExaS_Init(LOGICANALYZER, 1000); // initialize the Lab 4 logic analyzer
+  OS_Launch(BSP_Clock_GetFreq()/1000);
+  return 0;             // this never executes
+}
+/* ****************************************** */
+/*      End of Sampling jitter test Section   */
+/* ****************************************** */
@@ -10,30 +10,634 @@
 #include "CortexM.h"
 #include "BSP.h"
 #include "../inc/tm4c123gh6pm.h"
+#include "trace.h"
 
 // function definitions in osasm.s
 void StartOS(void);
+long BasePriRaise(uint32_t basepri); // raise BASEPRI, return the old value
+void BasePriSet(long basepri);
 
-#define NUMTHREADS  8        // maximum number of threads
-#define NUMPERIODIC 2        // maximum number of periodic threads
-#define STACKSIZE   100      // number of 32-bit words in stack per thread
+#define NUMTHREADS  16       // maximum number of threads
+#define NUMPERIODIC 8        // maximum number of periodic triggers
+#define STACKSIZE   100      // number of 32-bit words in stack per thread for OS_AddThreads
+#define STACKPOOL   800      // number of 32-bit words shared by all thread stacks
+#define MINSTACK    32       // smallest stack OS_AddThread accepts
+#define STACKPAINT  ((int32_t)0xA5A5A5A5) // unused stack words hold this value
+#define STACKCANARY ((int32_t)0xC0DEFACE) // lowest word of every stack, overwritten on overflow
+#define NUMPRIORITY 32       // priorities 0 (highest) to 31 (lowest)
+#define QUANTUM     1        // time slices per turn a new thread gets, see OS_SetQuantum
+#define TICKLESS    1        // 1 stops the 1 ms interrupts while no thread is ready
+#define MAXIDLE     10000    // longest tickless idle time in ms
+#define IDLESTACK   128      // words of stack for the idle thread, ISRs run on it too
+#define LOADWINDOW  1000     // ms over which OS_CPULoad is measured
+#define NUMEDGES    8        // maximum number of edge triggered pins
+#define EDGEDEBOUNCE 20      // ms OS_EdgeTrigger_Init ignores button1 after a touch
+#define WORKQUEUE   1        // 1 runs the jobs ISRs post with OS_Defer in a kernel thread
+#define DEFERSIZE   16       // jobs the work queue holds, power of 2
+#define DEFERSTACK  128      // words of stack for the work queue thread
+#ifndef DEFERPRIORITY
+#define DEFERPRIORITY 1      // priority of the work queue thread, below 1 ms threads at 0
+#endif
+#define SERVERS     1        // 1 enforces the budgets of OS_Server_Init with Wide Timer 1A
+#define MATCHMARGIN 80       // bus cycles, OS_SleepUntil wakes up at once if this close
+#ifndef EDF
+#define EDF         0        // 1 runs threads with deadlines earliest deadline first
+#endif
+#ifndef SEMARING
+#define SEMARING    0        // 1 makes OS_Signal search the TCB ring as before, for main_semabench
+#endif
+#define THREADSTATS 1        // 1 measures the run time of each thread with the DWT
+#ifndef TRACE
+#define TRACE       0        // 1 records kernel events in TraceLog, see trace.h
+#endif
+#define KERNELCEILING 1      // kernel critical sections mask NVIC priorities KERNELCEILING to 7
+#if (KERNELCEILING < 1)||(KERNELCEILING > 7)
+#error "KERNELCEILING must be 1 to 7"
+#endif
 
 struct tcb {
   int32_t *sp;       // pointer to stack (valid for threads not running
   struct tcb *next;  // linked-list pointer
+  int32_t *stack;    // lowest word of this thread's stack
+  uint32_t stackSize;// number of 32-bit words in stack
   // nonzero if blocked on this semaphore
-  int32_t *semaPt;
+  semaType *semaPt;
+  // next thread blocked on the same semaphore
+  struct tcb *nextBlocked;
   // nonzero if this thread is sleeping
   int32_t sleep;
-  // higher number lower priority
+  // sleeping threads are sorted by wake up time, and each one
+  // stores the number of ms after the one before it (delta list)
+  struct tcb *nextSleep;
+  uint32_t delta;
+  // OS_SleepUntil: time base value, in bus cycles, when it wakes up;
+  // such threads are in their own list, also linked by nextSleep
+  uint64_t wake;
+  // 1 if OS_WaitTimeout gave up before the semaphore was signaled
+  uint8_t timedOut;
+  // higher number lower priority, raised above basePriority
+  // while a higher priority thread waits on a mutex it owns
   uint32_t priority;
+  uint32_t basePriority;
+  // nonzero if blocked on this mutex
+  mutexType *mutexPt;
+  // nonzero if blocked on this event flag group, waiting for
+  // any or all of flagsMask; flagsGot returns the flags that
+  // ended the wait
+  flagsType *flagsPt;
+  uint32_t flagsMask;
+  uint32_t flagsGot;
+  uint8_t flagsAll;
+  uint8_t flagsClear;
+  // mutexes this thread owns
+  mutexType *held;
+  // circular list of ready threads at this priority
+  struct tcb *nextReady;
+  struct tcb *prevReady;
+  // time slices per turn at the head of that list, 0 for no limit,
+  // and slices left in this turn
+  uint32_t quantum;
+  uint32_t sliceLeft;
+  // NULL unless it runs under a sporadic server
+  serverType *server;
+  // EDF mode: relative deadline in ms, 0 if none, absolute
+  // deadline of the current job, deadline inherited from a thread
+  // blocked on a mutex it owns if inherited is 1, the earlier of
+  // the two, which orders DeadlineHeap, and place in DeadlineHeap
+  uint32_t relDeadline;
+  uint32_t jobDeadline;
+  uint32_t waiterDeadline;
+  uint32_t inherited;
+  uint32_t deadline;
+  uint32_t heapIndex;
+  uint32_t misses;   // jobs that finished after their deadline
+  uint64_t runCycles;// bus cycles this thread has run
+  uint32_t switches; // number of times switched in
 };
 
 typedef struct tcb tcbType;
 tcbType tcbs[NUMTHREADS];
+uint32_t NumThreads;         // tcbs[0] to tcbs[NumThreads-1] are in use
 tcbType *RunPt;
-int32_t Stacks[NUMTHREADS][STACKSIZE];
+// thread stacks are carved from one pool, in the order threads are added
+__align(8) int32_t StackPool[STACKPOOL]; // each stack starts on an even word
+uint32_t StackUsed;          // number of words of StackPool given out
+tcbType *StackFault;         // thread that overflowed its stack, NULL if none
+tcbType *SleepPt;            // first thread to wake up, NULL if none sleeping
+tcbType *UsSleepPt;          // first OS_SleepUntil thread to wake up, NULL if none
+uint32_t CyclesPerUs;        // time base counts per us
+void static TimeBase_Init(void);
+// the kernel's idle thread runs when no other thread is ready; it is
+// not in tcbs[] or on a ready list, and has a priority below 31
+tcbType IdleTcb;
+__align(8) int32_t IdleStack[IDLESTACK];
+uint32_t IdleCycles;         // bus cycles spent in WFI this window
+uint32_t LoadStart;          // OSTime when this window started
+uint32_t LoadCycles;         // DWTCYCCNT when this window started
+uint32_t CPULoad;            // busy time of the last window, 0.1%
+#if WORKQUEUE
+// the kernel's work queue thread runs the jobs ISRs post with
+// OS_Defer; like the idle thread it is not in tcbs[]
+tcbType WorkerTcb;
+__align(8) int32_t WorkerStack[DEFERSTACK];
+void static Worker(void);
+struct job {
+  void (*function)(uint32_t);
+  uint32_t arg;
+};
+struct job DeferJobs[DEFERSIZE];
+uint32_t DeferPutI;          // jobs ever posted, only OS_Defer writes it
+uint32_t DeferGetI;          // jobs ever taken, only Worker writes it
+uint32_t DeferWaiting;       // 1 while Worker is blocked on DeferReady
+semaType DeferReady;
+uint32_t DeferLost;          // jobs a full queue turned away
+uint32_t DeferMax;           // most jobs ever waiting at once
+uint32_t DeferRuns;          // jobs Worker has run
+#endif
+#if SERVERS
+serverType *ServerList;      // every sporadic server, see OS_Server_Init
+serverType *Charging;        // server whose budget RunPt is using, NULL if none
+uint32_t ChargeStart;        // DWTCYCCNT when it started using it
+void static ServerStop(tcbType *thread);
+void static ServerStart(tcbType *thread);
+void static ServerTick(void);
+void static BudgetTimer_Init(void);
+#endif
 void static runperiodicevents(void);
+void static SetInitialStack(tcbType *thread, void(*task)(void));
+void static EdgeTick(void);
+void static TimerTick(void);
+timerType *TimerPt;          // first software timer to expire, NULL if none
+uint32_t NumEdges;           // edge triggered pins, see OS_Edge_Init
+uint32_t EdgeDebouncing;     // number of them waiting to be rearmed
+uint32_t static NextRelease(void);
+void static ReleaseSkip(uint32_t ticks);
+int static ReleaseAdd(semaType *semaPt, flagsType *flagsPt, uint32_t flags,
+                      uint32_t period, uint32_t phase);
+
+// ready threads are kept in one list per priority
+// bit 31 of ReadyBits is set if priority 0 has a ready thread,
+// bit 30 for priority 1, ..., so CLZ gives the highest ready priority
+uint32_t ReadyBits;
+tcbType *ReadyList[NUMPRIORITY];
+uint32_t OSTime;             // ms since OS_Init
+uint32_t DeadlineMisses;     // total number of jobs that finished late
+uint32_t LastSwitch;         // DWTCYCCNT when RunPt was switched in
+
+#if TRACE
+// kernel events go into a ring buffer; save TraceLog from the
+// debugger and turn it into a timeline with ../TraceDecoder
+struct traceLog TraceLog;
+
+// ******** TraceWrite ************
+// Add one event to the trace, from any thread or ISR
+// A slot is taken with LDREX/STREX, so a writer never disables
+// interrupts or waits for another one
+// Inputs:  event code, thread number, argument (see trace.h)
+// Outputs: none
+void static TraceWrite(uint8_t event, uint8_t thread, uint16_t arg){
+  struct traceEntry *entry;
+  uint32_t count;
+  do{
+    count = __ldrex(&TraceLog.count);
+  }while(__strex(count+1, &TraceLog.count)); // an interrupt got in, try again
+  entry = &TraceLog.entry[count&(TRACESIZE-1)];
+  entry->time = DWTCYCCNT;
+  entry->event = event;
+  entry->thread = thread;
+  entry->arg = arg;
+}
+#define TRACEPOINT(event,thread,arg) TraceWrite(event,thread,arg)
+#else
+#define TRACEPOINT(event,thread,arg)
+#endif
+// kernel critical sections set BASEPRI instead of PRIMASK, so
+// interrupts with priority 0 to KERNELCEILING-1 are never delayed
+// by the kernel; such ISRs must not call any OS_ function
+// (OS_Ring_Put is fine on a ring without a wake semaphore).
+// Nested sections keep the outer level, BASEPRI_MAX only raises it.
+uint32_t KernelBasePri = KERNELCEILING<<5; // also used by PendSV_Handler
+#define KernelEnter() BasePriRaise(KERNELCEILING<<5)
+#define KernelExit(sr) BasePriSet(sr)
+
+// thread number used in the trace
+#if WORKQUEUE
+#define TRACEID(thread) (((thread) == &WorkerTcb) ? TRACE_WORKER : \
+  (((thread) && ((thread) != &IdleTcb)) ? (uint8_t)((thread)-tcbs) : TRACE_NOTHREAD))
+#else
+#define TRACEID(thread) (((thread) && ((thread) != &IdleTcb)) ? (uint8_t)((thread)-tcbs) : TRACE_NOTHREAD)
+#endif
+// semaphore identifier used in the trace
+#define TRACESEMA(semaPt) ((uint16_t)(uint32_t)(semaPt))
+
+#if EDF
+// in EDF mode ready threads with a deadline, their own or one
+// inherited through a mutex, are kept in a binary heap, earliest
+// absolute deadline at DeadlineHeap[0], and run before any
+// thread without a deadline
+tcbType *DeadlineHeap[NUMTHREADS];
+uint32_t HeapSize;
+#define TIMED(thread) ((thread)->relDeadline || (thread)->inherited)
+
+// 1 if thread a is due before thread b, correct across OSTime wrap around
+int static Earlier(tcbType *a, tcbType *b){
+  return (int32_t)(a->deadline - b->deadline) < 0;
+}
+
+// ******** HeapMove ************
+// Move a thread up or down the deadline heap to its place
+// Inputs:  heap index of a thread that may be out of place
+// Outputs: none
+void static HeapMove(uint32_t i){
+  tcbType *thread = DeadlineHeap[i];
+  uint32_t child;
+  while((i > 0)&&Earlier(thread, DeadlineHeap[(i-1)/2])){
+    DeadlineHeap[i] = DeadlineHeap[(i-1)/2]; // parent moves down
+    DeadlineHeap[i]->heapIndex = i;
+    i = (i-1)/2;
+  }
+  while((child = 2*i+1) < HeapSize){
+    if((child+1 < HeapSize)&&Earlier(DeadlineHeap[child+1], DeadlineHeap[child])){
+      child = child+1;                       // earlier of the two children
+    }
+    if(!Earlier(DeadlineHeap[child], thread)){
+      break;
+    }
+    DeadlineHeap[i] = DeadlineHeap[child];   // child moves up
+    DeadlineHeap[i]->heapIndex = i;
+    i = child;
+  }
+  DeadlineHeap[i] = thread;
+  thread->heapIndex = i;
+}
+
+// ******** EffectiveDeadline ************
+// Inputs:  thread with a deadline of its own or an inherited one
+// Outputs: the one it is scheduled by, the earlier of the two
+uint32_t static EffectiveDeadline(tcbType *thread){
+  if(thread->relDeadline == 0){
+    return thread->waiterDeadline;
+  }
+  if(thread->inherited && ((int32_t)(thread->waiterDeadline - thread->jobDeadline) < 0)){
+    return thread->waiterDeadline;
+  }
+  return thread->jobDeadline;
+}
+#else
+#define TIMED(thread) 0
+#endif
+
+// ******** ReadyLink ************
+// Put a thread into the ready structure it belongs in, the
+// deadline heap or the end of the ready list for its priority
+// Inputs:  thread that is not in either
+// Outputs: none
+// Must be called with interrupts disabled
+void static ReadyLink(tcbType *thread){
+  tcbType *head;
+#if EDF
+  if(TIMED(thread)){
+    thread->deadline = EffectiveDeadline(thread);
+    DeadlineHeap[HeapSize] = thread;
+    HeapSize++;
+    HeapMove(HeapSize-1);
+    return;
+  }
+#endif
+  head = ReadyList[thread->priority];
+  if(head == NULL){
+    thread->nextReady = thread;
+    thread->prevReady = thread;
+    ReadyList[thread->priority] = thread;
+    ReadyBits |= 0x80000000>>thread->priority;
+  } else{
+    thread->nextReady = head;            // insert before head, at the end
+    thread->prevReady = head->prevReady;
+    head->prevReady->nextReady = thread;
+    head->prevReady = thread;
+  }
+}
+
+// ******** ReadyUnlink ************
+// Take a thread out of the deadline heap or its ready list
+// Inputs:  thread that ReadyLink put in
+// Outputs: none
+// Must be called with interrupts disabled
+void static ReadyUnlink(tcbType *thread){
+#if EDF
+  uint32_t i;
+  if(TIMED(thread)){
+    i = thread->heapIndex;
+    HeapSize--;
+    if(i < HeapSize){                    // last thread fills the hole
+      DeadlineHeap[i] = DeadlineHeap[HeapSize];
+      HeapMove(i);
+    }
+    return;
+  }
+#endif
+  if(thread->nextReady == thread){       // last ready thread at this priority
+    ReadyList[thread->priority] = NULL;
+    ReadyBits &= ~(0x80000000>>thread->priority);
+  } else{
+    thread->prevReady->nextReady = thread->nextReady;
+    thread->nextReady->prevReady = thread->prevReady;
+    if(ReadyList[thread->priority] == thread){
+      ReadyList[thread->priority] = thread->nextReady;
+    }
+  }
+}
+
+// ******** ReadyAdd ************
+// Make a thread ready with a full quantum for its next turn,
+// in EDF mode a thread with a deadline starts a new job
+// Inputs:  thread that is no longer blocked or sleeping
+// Outputs: none
+// Must be called with interrupts disabled
+void static ReadyAdd(tcbType *thread){
+  thread->sliceLeft = thread->quantum;
+#if EDF
+  if(thread->relDeadline){               // release a new job
+    thread->jobDeadline = OSTime+thread->relDeadline;
+  }
+#endif
+  ReadyLink(thread);
+}
+
+// ******** ReadyRemove ************
+// Take a thread out of the ready structures, in EDF mode the
+// job of a thread with a deadline is done
+// Inputs:  thread that is about to block or sleep
+// Outputs: none
+// Must be called with interrupts disabled
+void static ReadyRemove(tcbType *thread){
+#if EDF
+  if(thread->relDeadline && ((int32_t)(OSTime - thread->jobDeadline) > 0)){
+    thread->misses++;
+    DeadlineMisses++;
+  }
+#endif
+  ReadyUnlink(thread);
+}
+
+// ******** Beats ************
+// Inputs:  two threads
+// Outputs: 1 if thread a should run before thread b
+int static Beats(tcbType *a, tcbType *b){
+#if EDF
+  if(TIMED(a) && TIMED(b)){
+    return Earlier(a, b);
+  }
+  if(TIMED(a) || TIMED(b)){
+    return TIMED(a);                     // deadlines first
+  }
+#endif
+  return a->priority < b->priority;
+}
+
+// ******** BestReady ************
+// Inputs:  none
+// Outputs: the ready thread that should run, the idle thread if none
+// Must be called with interrupts disabled
+tcbType static *BestReady(void){
+#if EDF
+  if(HeapSize){
+    return DeadlineHeap[0];
+  }
+#endif
+  if(ReadyBits == 0){
+    return &IdleTcb;
+  }
+  return ReadyList[__clz(ReadyBits)];
+}
+
+// ******** SleepInsert ************
+// Put a thread into the sorted list of sleeping threads
+// Inputs:  thread to put to sleep
+//          number of msec to sleep, greater than zero
+// Outputs: none
+// Must be called with interrupts disabled
+void static SleepInsert(tcbType *thread, uint32_t sleepTime){
+  tcbType *prev = NULL;
+  tcbType *cur = SleepPt;
+  while (cur && cur->delta <= sleepTime) {  // after those that wake up first
+    sleepTime = sleepTime - cur->delta;
+    prev = cur;
+    cur = cur->nextSleep;
+  }
+  thread->delta = sleepTime;
+  thread->nextSleep = cur;
+  if (cur) {
+    cur->delta = cur->delta - sleepTime;    // cur now wakes up after thread
+  }
+  if (prev) {
+    prev->nextSleep = thread;
+  } else {
+    SleepPt = thread;
+  }
+}
+
+// ******** SleepRemove ************
+// Take a thread out of the sleeping list before its time is up
+// Inputs:  sleeping thread
+// Outputs: none
+// Must be called with interrupts disabled
+void static SleepRemove(tcbType *thread){
+  tcbType **pt = &SleepPt;
+  while (*pt != thread) {
+    pt = &(*pt)->nextSleep;
+  }
+  *pt = thread->nextSleep;
+  if (thread->nextSleep) {            // the next one waits for both deltas
+    thread->nextSleep->delta = thread->nextSleep->delta + thread->delta;
+  }
+  thread->sleep = 0;
+}
+
+// ******** SemaBlock ************
+// Add a thread to the end of the FIFO of threads blocked on a
+// semaphore, the caller has already decremented it
+// Inputs:  semaphore
+//          thread to block, ready now
+// Outputs: none
+// Must be called with interrupts disabled
+void static SemaBlock(semaType *semaPt, tcbType *thread){
+  thread->semaPt = semaPt;
+#if SEMARING
+  ReadyRemove(thread);     // OS_Signal finds it by searching the TCBs
+  return;
+#endif
+  thread->nextBlocked = NULL;
+  if (semaPt->head == NULL) {
+    semaPt->head = thread;
+  } else {
+    semaPt->tail->nextBlocked = thread;
+  }
+  semaPt->tail = thread;
+  ReadyRemove(thread);
+}
+
+// ******** SemaRemove ************
+// Take a thread out of the threads blocked on a semaphore and
+// give back the count it took, as if it had never waited
+// Inputs:  semaphore
+//          thread blocked on it
+// Outputs: none
+// Must be called with interrupts disabled
+void static SemaRemove(semaType *semaPt, tcbType *thread){
+  tcbType *prev = NULL;
+  tcbType **pt = &semaPt->head;
+#if SEMARING
+  semaPt->value = semaPt->value + 1;
+  thread->semaPt = NULL;
+  return;
+#endif
+  while (*pt != thread) {
+    prev = *pt;
+    pt = &(*pt)->nextBlocked;
+  }
+  *pt = thread->nextBlocked;
+  if (semaPt->tail == thread) {
+    semaPt->tail = prev;
+  }
+  semaPt->value = semaPt->value + 1;
+  thread->semaPt = NULL;
+}
+
+#if TICKLESS
+uint32_t TickCycles;         // bus cycles in one 1 ms tick
+uint32_t SkippedTicks;       // number of 1 ms interrupts not taken while idle
+
+// ******** TickStretch ************
+// Delay the next timeout of a 1 ms periodic wide timer so it
+// interrupts after ticks ms instead; it goes back to 1 ms
+// on its own because the reload value is not changed
+// Inputs:  the timer's TAV register
+//          number of ms until the next interrupt, at least 2
+// Outputs: none
+// Must be called with interrupts disabled
+void static TickStretch(volatile uint32_t *tav, uint32_t ticks){
+  *tav = *tav + (ticks-1)*TickCycles;
+}
+
+// ******** TickResume ************
+// Put a timer delayed by TickStretch back on its 1 ms period,
+// keeping the same phase
+// Inputs:  the timer's TAV and RIS registers
+//          number of ms given to TickStretch
+// Outputs: number of 1 ms ticks that passed without an interrupt
+// Must be called with interrupts disabled
+uint32_t static TickResume(volatile uint32_t *tav, volatile uint32_t *ris, uint32_t ticks){
+  uint32_t left,remaining;
+  left = *tav;                       // cycles until the delayed timeout
+  if (((*ris)&TIMER_RIS_TATORIS) || (left == 0)) {
+    return ticks-1;                  // timed out, ISR handles the last tick
+  }
+  remaining = (left+TickCycles-1)/TickCycles; // ticks not reached yet
+  *tav = left - (remaining-1)*TickCycles;     // time to the next tick
+  return ticks-remaining;
+}
+#endif
+
+// ******** IdleWait ************
+// Called by the idle thread when no other thread is ready
+// Sleeps until an interrupt is pending. In tickless mode the
+// SysTick time slice is stopped, and the 1 ms sleep and periodic
+// release timers interrupt only when the first sleeping thread
+// must wake up or the next periodic release is due
+// Inputs:  none
+// Outputs: none
+// Must be called with interrupts disabled, the pending ISR runs
+// when interrupts are enabled again
+void static IdleWait(void){
+#if TICKLESS
+  uint32_t sleepTicks,releaseTicks,skipped;
+  releaseTicks = NextRelease();      // 0 if WideTimer3 is not used
+  if ((WTIMER4_RIS_R&TIMER_RIS_TATORIS) ||
+      (releaseTicks && (WTIMER3_RIS_R&TIMER_RIS_TATORIS))) {
+    return;                          // a tick is already pending
+  }
+  sleepTicks = MAXIDLE;
+  if (SleepPt && (SleepPt->delta < sleepTicks)) {
+    sleepTicks = SleepPt->delta;
+  }
+  if (TimerPt && (TimerPt->delta < sleepTicks)) {
+    sleepTicks = TimerPt->delta;
+  }
+  if (EdgeDebouncing) {
+    sleepTicks = 1;                  // the tick rearms an edge trigger
+  }
+  if ((sleepTicks < 2) && (releaseTicks < 2)) {
+    WaitForInterrupt();              // next tick is needed anyway
+    return;
+  }
+  STCTRL = 0;                        // no time slices while idle
+  if (sleepTicks >= 2) {
+    TickStretch(&WTIMER4_TAV_R, sleepTicks);
+  }
+  if (releaseTicks >= 2) {
+    TickStretch(&WTIMER3_TAV_R, releaseTicks);
+  }
+  WaitForInterrupt();                // any interrupt wakes up
+  if (sleepTicks >= 2) {
+    skipped = TickResume(&WTIMER4_TAV_R, &WTIMER4_RIS_R, sleepTicks);
+    if (SleepPt) {
+      SleepPt->delta = SleepPt->delta - skipped;
+    }
+    if (TimerPt) {
+      TimerPt->delta = TimerPt->delta - skipped;
+    }
+    SkippedTicks = SkippedTicks + skipped;
+    OSTime = OSTime + skipped;
+  }
+  if (releaseTicks >= 2) {
+    ReleaseSkip(TickResume(&WTIMER3_TAV_R, &WTIMER3_RIS_R, releaseTicks));
+  }
+  STCURRENT = 0;                     // next thread gets a full time slice
+  STCTRL = 0x00000007;
+#else
+  WaitForInterrupt();                // wakes up even with interrupts disabled
+#endif
+}
+
+// ******** LoadWindow ************
+// Close the CPU load window once LOADWINDOW ms have passed,
+// called every 1 ms tick and each time the idle thread wakes up
+// Inputs:  none
+// Outputs: none
+// Must be called with interrupts disabled
+void static LoadWindow(void){
+  uint32_t now,elapsed;
+  if ((OSTime - LoadStart) < LOADWINDOW) {
+    return;
+  }
+  now = DWTCYCCNT;
+  elapsed = now - LoadCycles;
+  if (elapsed) {
+    CPULoad = (uint32_t)(((uint64_t)(elapsed - IdleCycles)*1000)/elapsed);
+  }
+  IdleCycles = 0;
+  LoadStart = OSTime;
+  LoadCycles = now;
+}
+
+// ******** Idle ************
+// The kernel's idle thread, runs only when no other thread is ready
+// WFI only wakes up for interrupts BASEPRI lets through, so it
+// waits with PRIMASK set instead and counts the cycles it slept
+// Inputs:  none
+// Outputs: none (never returns)
+void static Idle(void){
+  uint32_t start;
+  while(1){
+    DisableInterrupts();
+    start = DWTCYCCNT;
+    IdleWait();
+    IdleCycles = IdleCycles + (DWTCYCCNT - start);
+    LoadWindow();         // tickless idle skips the 1 ms ticks
+    EnableInterrupts();   // let the ISR signal or wake a thread
+  }
+}
 
 // ******** OS_Init ************
 // Initialize operating system, disable interrupts
@@ -42,38 +646,176 @@ void static runperiodicevents(void);
 // Inputs:  none
 // Outputs: none
 void OS_Init(void){
-  DisableInterrupts();
+  int i;
+  DisableInterrupts();   // until StartOS runs the first thread
   BSP_Clock_InitFastest();// set processor clock to fastest speed
 // perform any initializations needed,
 // set up periodic timer to run runperiodicevents to implement sleeping
   BSP_PeriodicTask_InitB(&runperiodicevents, 1000, 5);
+  NumThreads = 0;
+  StackUsed = 0;
+  OSTime = 0;
+  DeadlineMisses = 0;
+  DEMCR |= 0x01000000;        // enable DWT
+  DWTCTRL |= 0x00000001;      // enable cycle counter
+#if TRACE
+  TraceLog.count = 0;
+  TraceLog.clockHz = BSP_Clock_GetFreq();
+  TraceLog.magic = TRACEMAGIC;
+#endif
+#if EDF
+  HeapSize = 0;
+#endif
+  RunPt = NULL;
+  SleepPt = NULL;
+  UsSleepPt = NULL;
+  TimeBase_Init();
+  TimerPt = NULL;
+  NumEdges = 0;
+  EdgeDebouncing = 0;
+  ReadyBits = 0;
+  for(i=0; i<NUMPRIORITY; i++){
+    ReadyList[i] = NULL;
+  }
+#if TICKLESS
+  TickCycles = BSP_Clock_GetFreq()/1000;
+#endif
+  IdleTcb.stack = IdleStack;
+  IdleTcb.stackSize = IDLESTACK;
+  IdleStack[0] = STACKCANARY;
+  IdleTcb.priority = NUMPRIORITY;   // below every thread
+  IdleTcb.basePriority = NUMPRIORITY;
+  IdleTcb.relDeadline = 0;
+  IdleTcb.inherited = 0;
+  IdleTcb.runCycles = 0;
+  IdleTcb.switches = 0;
+  SetInitialStack(&IdleTcb, &Idle);
+  IdleCycles = 0;
+  LoadStart = 0;
+  LoadCycles = DWTCYCCNT;
+  CPULoad = 0;
+#if WORKQUEUE
+  DeferPutI = 0;
+  DeferGetI = 0;
+  DeferWaiting = 0;
+  OS_InitSemaphore(&DeferReady, 0);
+  WorkerTcb.stack = WorkerStack;
+  WorkerTcb.stackSize = DEFERSTACK;
+  WorkerStack[0] = STACKCANARY;
+  WorkerTcb.sleep = 0;
+  WorkerTcb.semaPt = NULL;
+  WorkerTcb.priority = DEFERPRIORITY;
+  WorkerTcb.basePriority = DEFERPRIORITY;
+  WorkerTcb.mutexPt = NULL;
+  WorkerTcb.held = NULL;
+  WorkerTcb.flagsPt = NULL;
+  WorkerTcb.relDeadline = 0;
+  WorkerTcb.inherited = 0;
+  WorkerTcb.quantum = QUANTUM;
+  WorkerTcb.server = NULL;
+  WorkerTcb.runCycles = 0;
+  WorkerTcb.switches = 0;
+  SetInitialStack(&WorkerTcb, &Worker);
+  ReadyAdd(&WorkerTcb);       // runs first, and blocks until a job is posted
+#endif
+#if SERVERS
+  ServerList = NULL;
+  Charging = NULL;
+  BudgetTimer_Init();
+#endif
 }
 
-void SetInitialStack(int i){
-  // ****IMPLEMENT THIS****
-  // **Same as Lab 2 and Lab 3****
-  tcbs[i].sp = &Stacks[i][STACKSIZE-16]; // thread stack pointer
-  Stacks[i][STACKSIZE-1] = 0x01000000;   // thumb bit
-  Stacks[i][STACKSIZE-3] = 0x14141414;   // R14
-  Stacks[i][STACKSIZE-4] = 0x12121212;   // R12
-  Stacks[i][STACKSIZE-5] = 0x03030303;   // R3
-  Stacks[i][STACKSIZE-6] = 0x02020202;   // R2
-  Stacks[i][STACKSIZE-7] = 0x01010101;   // R1
-  Stacks[i][STACKSIZE-8] = 0x00000000;   // R0
-  Stacks[i][STACKSIZE-9] = 0x11111111;   // R11
-  Stacks[i][STACKSIZE-10] = 0x10101010;  // R10
-  Stacks[i][STACKSIZE-11] = 0x09090909;  // R9
-  Stacks[i][STACKSIZE-12] = 0x08080808;  // R8
-  Stacks[i][STACKSIZE-13] = 0x07070707;  // R7
-  Stacks[i][STACKSIZE-14] = 0x06060606;  // R6
-  Stacks[i][STACKSIZE-15] = 0x05050505;  // R5
-  Stacks[i][STACKSIZE-16] = 0x04040404;  // R4
+// ******** SetInitialStack ************
+// Build the stack frame PendSV_Handler pops the first time
+// a thread runs, at the top of the thread's stack
+// Inputs:  thread with stack and stackSize already set
+//          function pointer to its void/void main thread
+// Outputs: none
+void static SetInitialStack(tcbType *thread, void(*task)(void)){
+  int32_t *top = &thread->stack[thread->stackSize]; // one past the last word
+  thread->sp = top-16;         // thread stack pointer
+  top[-1] = 0x01000000;        // thumb bit
+  top[-2] = (int32_t)(task);   // PC
+  top[-3] = 0x14141414;        // R14
+  top[-4] = 0x12121212;        // R12
+  top[-5] = 0x03030303;        // R3
+  top[-6] = 0x02020202;        // R2
+  top[-7] = 0x01010101;        // R1
+  top[-8] = 0x00000000;        // R0
+  top[-9] = 0x11111111;        // R11
+  top[-10] = 0x10101010;       // R10
+  top[-11] = 0x09090909;       // R9
+  top[-12] = 0x08080808;       // R8
+  top[-13] = 0x07070707;       // R7
+  top[-14] = 0x06060606;       // R6
+  top[-15] = 0x05050505;       // R5
+  top[-16] = 0x04040404;       // R4
+}
+
+//******** OS_AddThread ***************
+// Add one main thread to the scheduler, with a stack of its own size
+// taken from the stack pool. Can be called before or after OS_Launch.
+// Inputs: function pointer to a void/void main thread
+//         priority (0 highest, 31 lowest)
+//         number of 32-bit words in its stack, at least MINSTACK
+//         (rounded up to even, so every stack stays 8-byte aligned)
+// Outputs: 1 if successful, 0 if this thread can not be added
+int OS_AddThread(void(*task)(void), uint32_t priority, uint32_t stackWords){
+  long status;
+  uint32_t i;
+  tcbType *thread;
+  stackWords = (stackWords+1)&~1;
+  if((priority >= NUMPRIORITY)||(stackWords < MINSTACK)){
+    return 0;             // bad priority or stack too small
+  }
+  status = KernelEnter();
+  if((NumThreads == NUMTHREADS)||(StackUsed+stackWords > STACKPOOL)){
+    KernelExit(status);
+    return 0;             // out of TCBs or stack space
+  }
+  thread = &tcbs[NumThreads];
+  thread->stack = &StackPool[StackUsed];
+  thread->stackSize = stackWords;
+  StackUsed = StackUsed+stackWords;
+  thread->stack[0] = STACKCANARY;
+  for(i=1; i<stackWords; i++){
+    thread->stack[i] = STACKPAINT; // so OS_StackUsage can find the deepest word used
+  }
+  thread->sleep = 0;      // not sleeping
+  thread->semaPt = NULL;  // not blocked
+  thread->priority = priority;
+  thread->basePriority = priority;
+  thread->mutexPt = NULL;
+  thread->held = NULL;
+  thread->flagsPt = NULL;
+  thread->relDeadline = 0;  // fixed priority until OS_SetDeadline
+  thread->inherited = 0;
+  thread->quantum = QUANTUM;
+  thread->server = NULL;  // not served until OS_Server_Init
+  thread->misses = 0;
+  thread->runCycles = 0;
+  thread->switches = 0;
+  SetInitialStack(thread, task);
+  // add to the end of the TCB circular list
+  thread->next = &tcbs[0];
+  if(NumThreads > 0){
+    tcbs[NumThreads-1].next = thread;
+  }
+  NumThreads++;
+  ReadyAdd(thread);       // new threads start ready
+  if(RunPt == NULL){
+    RunPt = thread;       // OS_Launch will pick the highest priority one
+  } else if(Beats(thread, RunPt)){
+    INTCTRL = 0x10000000; // trigger PendSV, new thread runs now
+  }
+  KernelExit(status);
+  return 1;               // successful
 }
 
 //******** OS_AddThreads ***************
-// Add eight main threads to the scheduler
+// Add eight main threads to the scheduler, each with STACKSIZE words of stack
 // Inputs: function pointers to eight void/void main threads
-//         priorites for each main thread (0 highest)
+//         priorites for each main thread (0 highest, 31 lowest)
 // Outputs: 1 if successful, 0 if this thread can not be added
 // This function will only be called once, after OS_Init and before OS_Launch
 int OS_AddThreads(void(*thread0)(void), uint32_t p0,
@@ -84,79 +826,107 @@ int OS_AddThreads(void(*thread0)(void), uint32_t p0,
                   void(*thread5)(void), uint32_t p5,
                   void(*thread6)(void), uint32_t p6,
                   void(*thread7)(void), uint32_t p7){
-  int32_t status;
-  status = StartCritical();
-
-  // initialize TCB circular list
-  tcbs[0].next = &tcbs[1]; // 0 points to 1
-  tcbs[1].next = &tcbs[2]; // 1 points to 2
-  tcbs[2].next = &tcbs[3]; // 2 points to 3
-  tcbs[3].next = &tcbs[4]; // 3 points to 4
-  tcbs[4].next = &tcbs[5]; // 4 points to 5
-  tcbs[5].next = &tcbs[6]; // 5 points to 6
-  tcbs[6].next = &tcbs[7]; // 6 points to 7
-  tcbs[7].next = &tcbs[0]; // 7 points to 0
-
-  // initialize threads to be not sleeping
-  tcbs[0].sleep = 0;
-  tcbs[1].sleep = 0;
-  tcbs[2].sleep = 0;
-  tcbs[3].sleep = 0;
-  tcbs[4].sleep = 0;
-  tcbs[5].sleep = 0;
-  tcbs[6].sleep = 0;
-  tcbs[7].sleep = 0;
-
-  // initialize threads to be not blocking
-  tcbs[0].semaPt = NULL;
-  tcbs[1].semaPt = NULL;
-  tcbs[2].semaPt = NULL;
-  tcbs[3].semaPt = NULL;
-  tcbs[4].semaPt = NULL;
-  tcbs[5].semaPt = NULL;
-  tcbs[6].semaPt = NULL;
-  tcbs[7].semaPt = NULL;
-
-  // initialize priority
-  tcbs[0].priority = p0;
-  tcbs[1].priority = p1;
-  tcbs[2].priority = p2;
-  tcbs[3].priority = p3;
-  tcbs[4].priority = p4;
-  tcbs[5].priority = p5;
-  tcbs[6].priority = p6;
-  tcbs[7].priority = p7;
-
-  // initialize 8 stacks, including initial PC
-  SetInitialStack(0);
-  Stacks[0][STACKSIZE-2] = (int32_t)(thread0); // PC
-
-  SetInitialStack(1);
-  Stacks[1][STACKSIZE-2] = (int32_t)(thread1); // PC
-
-  SetInitialStack(2);
-  Stacks[2][STACKSIZE-2] = (int32_t)(thread2); // PC
-
-  SetInitialStack(3);
-  Stacks[3][STACKSIZE-2] = (int32_t)(thread3); // PC
-
-  SetInitialStack(4);
-  Stacks[4][STACKSIZE-2] = (int32_t)(thread4); // PC
-
-  SetInitialStack(5);
-  Stacks[5][STACKSIZE-2] = (int32_t)(thread5); // PC
-
-  SetInitialStack(6);
-  Stacks[6][STACKSIZE-2] = (int32_t)(thread6); // PC
-
-  SetInitialStack(7);
-  Stacks[7][STACKSIZE-2] = (int32_t)(thread7); // PC
-
-  // initialize RunPt
-  RunPt = &tcbs[0];       // thread 0 will run first
-
-  EndCritical(status);
-  return 1;               // successful
+  if((p0|p1|p2|p3|p4|p5|p6|p7) >= NUMPRIORITY){
+    return 0;             // priority out of range, nothing added
+  }
+  return OS_AddThread(thread0, p0, STACKSIZE) &&
+         OS_AddThread(thread1, p1, STACKSIZE) &&
+         OS_AddThread(thread2, p2, STACKSIZE) &&
+         OS_AddThread(thread3, p3, STACKSIZE) &&
+         OS_AddThread(thread4, p4, STACKSIZE) &&
+         OS_AddThread(thread5, p5, STACKSIZE) &&
+         OS_AddThread(thread6, p6, STACKSIZE) &&
+         OS_AddThread(thread7, p7, STACKSIZE);
+}
+
+//******** OS_StackUsage ***************
+// Deepest the stack of a thread has ever grown, found by looking
+// for the first word above the canary that is no longer painted
+// Inputs: thread number, 0 for the first thread added
+// Outputs: number of 32-bit words used, including the initial
+//          register frame, -1 if there is no such thread, or
+//          -2 if it overflowed and wrote over the canary
+int32_t OS_StackUsage(uint32_t thread){
+  tcbType *pt;
+  uint32_t i;
+  if(thread >= NumThreads){
+    return -1;
+  }
+  pt = &tcbs[thread];
+  if(pt->stack[0] != STACKCANARY){
+    return -2;            // how deep it went is unknown
+  }
+  i = 1;
+  while((i < pt->stackSize)&&(pt->stack[i] == STACKPAINT)){
+    i++;
+  }
+  return pt->stackSize-i;
+}
+
+//******** OS_GetThreadStats ***************
+// Processor time used by a thread, measured with the DWT cycle
+// counter at every context switch. Time spent idle is not
+// charged to any thread.
+// Inputs: thread number, 0 for the first thread added
+//         place to store the statistics
+// Outputs: 1 if successful, 0 if there is no such thread
+int OS_GetThreadStats(uint32_t thread, threadStatsType *stats){
+  tcbType *pt;
+  uint64_t elapsed;
+  long status;
+  if(thread >= NumThreads){
+    return 0;
+  }
+  pt = &tcbs[thread];
+  status = KernelEnter();
+  stats->runCycles = pt->runCycles;
+  if(pt == RunPt){
+    stats->runCycles += DWTCYCCNT - LastSwitch; // include the current time slice
+  }
+  stats->switches = pt->switches;
+  elapsed = (uint64_t)OSTime*(BSP_Clock_GetFreq()/1000);
+  KernelExit(status);
+  stats->utilization = 0;
+  if(elapsed){
+    stats->utilization = (uint32_t)((stats->runCycles*1000)/elapsed);
+  }
+  return 1;
+}
+
+//******** OS_CPULoad ***************
+// Fraction of the time the processor was not idle, over the
+// last complete window of at least LOADWINDOW ms; ISRs count as busy
+// Inputs: none
+// Outputs: load in 0.1% units, 0 to 1000, 0 for the first window
+uint32_t OS_CPULoad(void){
+  return CPULoad;
+}
+
+//******** OS_Trace ***************
+// Record an event in the kernel trace, so user ISRs and
+// threads show up in the timeline next to the kernel events
+// Inputs: event code from trace.h, e.g. TRACE_ISRENTER
+//         argument, e.g. the vector number
+// Outputs: none
+// Does nothing unless TRACE is 1 in os.c
+void OS_Trace(uint8_t event, uint16_t arg){
+#if TRACE
+  TRACEPOINT(event, TRACEID(RunPt), arg);
+#else
+  (void)event; (void)arg;
+#endif
+}
+
+// ******** StackOverflow ************
+// Called with interrupts disabled when a thread has written
+// over the canary at the bottom of its stack, so the stack
+// below it (another thread's) may be corrupt too
+// Stops the system, view StackFault in the debugger
+// Inputs:  thread that overflowed
+// Outputs: none (does not return)
+void static StackOverflow(tcbType *thread){
+  StackFault = thread;
+  while(1){};
 }
 
 
@@ -164,13 +934,42 @@ void static runperiodicevents(void){
 // ****IMPLEMENT THIS****
 // **DECREMENT SLEEP COUNTERS
 // In Lab 4, handle periodic events in RealTimeEvents
-  tcbType *cur = RunPt;
-  do {
-    if (cur->sleep) {
-      cur->sleep--;
+  tcbType *cur;
+  long sr = KernelEnter();
+  OSTime++;
+  TRACEPOINT(TRACE_ISRENTER, TRACEID(RunPt), 118); // WideTimer4A
+  LoadWindow();
+  if (EdgeDebouncing) {
+    EdgeTick();
+  }
+  // only the first sleeping thread is counted down,
+  // the others are stored relative to it
+  if (SleepPt) {
+    SleepPt->delta--;
+    while (SleepPt && SleepPt->delta == 0) {
+      cur = SleepPt;          // done sleeping
+      SleepPt = cur->nextSleep;
+      cur->sleep = 0;
+      if (cur->semaPt) {      // OS_WaitTimeout gives up
+        SemaRemove(cur->semaPt, cur);
+        cur->timedOut = 1;
+      }
+      ReadyAdd(cur);
+      if (Beats(cur, RunPt)) {
+        INTCTRL = 0x10000000; // trigger PendSV
+      }
     }
-    cur = cur->next;
-  } while (cur != RunPt);
+  }
+#if SERVERS
+  if (ServerList) {
+    ServerTick();
+  }
+#endif
+  KernelExit(sr);
+  if (TimerPt) {
+    TimerTick();              // callbacks run with interrupts enabled
+  }
+  TRACEPOINT(TRACE_ISREXIT, TRACEID(RunPt), 118);
 }
 
 //******** OS_Launch ***************
@@ -181,26 +980,72 @@ void static runperiodicevents(void){
 void OS_Launch(uint32_t theTimeSlice){
   STCTRL = 0;                  // disable SysTick during setup
   STCURRENT = 0;               // any write to current clears it
-  SYSPRI3 =(SYSPRI3&0x00FFFFFF)|0xE0000000; // priority 7
+  SYSPRI3 =(SYSPRI3&0x00FFFFFF)|0xE0000000; // SysTick priority 7
+  SYSPRI3 =(SYSPRI3&0xFF00FFFF)|0x00E00000; // PendSV priority 7
   STRELOAD = theTimeSlice - 1; // reload value
+  RunPt = BestReady();         // highest priority thread will run first
+  INTCTRL = 0x08000000;        // clear PendSV set by OS_AddThread
+#if THREADSTATS
+  RunPt->switches++;
+  LastSwitch = DWTCYCCNT;
+#endif
   STCTRL = 0x00000007;         // enable, core clock and interrupt arm
   StartOS();                   // start on the first task
 }
-// runs every ms
-void Scheduler(void) {
+// end of a time slice, runs every theTimeSlice cycles
+// equal priority threads take turns (round robin): the running
+// thread is charged the slice, and once it has used its quantum
+// the next ready thread at its priority gets a turn; a thread
+// alone at its priority, or with quantum 0, keeps running
+void SysTick_Handler(void) {
+  tcbType *cur;
+  long sr = KernelEnter();
+  TRACEPOINT(TRACE_ISRENTER, TRACEID(RunPt), 15);
+  cur = RunPt;
+  if ((cur != &IdleTcb) && (ReadyList[cur->priority] == cur) &&
+      (cur->nextReady != cur) && cur->quantum) {
+    if (cur->sliceLeft > 1) {
+      cur->sliceLeft--;
+    } else {                // end of its turn
+      cur->sliceLeft = cur->quantum;
+      ReadyList[cur->priority] = cur->nextReady;
+    }
+  }
+  if (BestReady() != cur) {
+    INTCTRL = 0x10000000;   // trigger PendSV
+  }
+  TRACEPOINT(TRACE_ISREXIT, TRACEID(RunPt), 15);
+  KernelExit(sr);
+}
 
-  uint32_t maxPriority;
-  tcbType *ptr, *best;
+// called from PendSV_Handler to choose the next thread
+// constant time: CLZ finds the highest priority with a ready thread,
+// or in EDF mode the earliest deadline is at the top of the heap
+void Scheduler(void) {
+  tcbType *best;
 
-  maxPriority = UINT32_MAX;
-  ptr = RunPt;
-  do {
-    ptr = ptr->next;
-    if (!ptr->sleep && !ptr->semaPt && ptr->priority < maxPriority) {
-      best = ptr;
-      maxPriority = ptr->priority;
-    }
-  } while (ptr != RunPt);
+#if THREADSTATS
+  RunPt->runCycles += DWTCYCCNT - LastSwitch;
+#endif
+  if (RunPt->stack[0] != STACKCANARY) { // check the thread being switched out
+    StackOverflow(RunPt);
+  }
+#if SERVERS
+  ServerStop(RunPt);        // may drop it to its low priority
+#endif
+  best = BestReady();       // the idle thread if every thread is blocked or sleeping
+  if (best != RunPt) {
+    TRACEPOINT(TRACE_SWITCH, TRACEID(best), TRACEID(RunPt));
+  }
+#if THREADSTATS
+  if (best != RunPt) {
+    best->switches++;
+  }
+  LastSwitch = DWTCYCCNT;
+#endif
+#if SERVERS
+  ServerStart(best);
+#endif
 
   RunPt = best;
 }
@@ -211,9 +1056,15 @@ void Scheduler(void) {
 // Outputs: none
 // Will be run again depending on sleep/block status
 void OS_Suspend(void){
+  long sr = KernelEnter();
+  if (ReadyList[RunPt->priority] == RunPt) { // still ready, let the next one run
+    RunPt->sliceLeft = RunPt->quantum;
+    ReadyList[RunPt->priority] = RunPt->nextReady;
+  }
   STCURRENT = 0;        // any write to current clears it
-  INTCTRL = 0x04000000; // trigger SysTick
 // next thread gets a full time slice
+  INTCTRL = 0x10000000; // trigger PendSV
+  KernelExit(sr);
 }
 
 // ******** OS_Sleep ************
@@ -222,19 +1073,73 @@ void OS_Suspend(void){
 // output: none
 // OS_Sleep(0) implements cooperative multitasking
 void OS_Sleep(uint32_t sleepTime){
+  long sr = KernelEnter();
+  TRACEPOINT(TRACE_SLEEP, TRACEID(RunPt), (sleepTime > 0xFFFF) ? 0xFFFF : sleepTime);
 // set sleep parameter in TCB
   RunPt->sleep = sleepTime;
+  if (sleepTime) {
+    ReadyRemove(RunPt);
+    SleepInsert(RunPt, sleepTime);
+  }
+  KernelExit(sr);
 // suspend, stops running
   OS_Suspend();
 }
 
+// ******** OS_SetQuantum ************
+// Set how many time slices in a row the calling thread may run
+// before the next ready thread at the same priority gets a turn
+// Inputs:  time slices per turn, 0 to run until it blocks, sleeps
+//          or calls OS_Suspend
+// Outputs: none
+// Starts a new turn for the calling thread
+void OS_SetQuantum(uint32_t slices){
+  long sr = KernelEnter();
+  RunPt->quantum = slices;
+  RunPt->sliceLeft = slices;
+  KernelExit(sr);
+}
+
+// ******** OS_SetDeadline ************
+// Give the calling thread a relative deadline for EDF scheduling
+// A job is released each time the thread becomes ready, due that
+// many ms later, and ends when the thread blocks or sleeps
+// Inputs:  relative deadline in ms, 0 to go back to fixed priority
+// Outputs: none
+// Has no effect unless EDF is 1 in os.c
+void OS_SetDeadline(uint32_t deadline){
+#if EDF
+  long sr = KernelEnter();
+  ReadyRemove(RunPt);
+  RunPt->relDeadline = deadline;
+  ReadyAdd(RunPt);          // first job released now
+  if(Beats(BestReady(), RunPt)){
+    INTCTRL = 0x10000000;   // trigger PendSV
+  }
+  KernelExit(sr);
+#else
+  (void)deadline;
+#endif
+}
+
+// ******** OS_DeadlineMisses ************
+// Number of EDF jobs that finished after their deadline,
+// the count for each thread is in its TCB
+// Inputs:  none
+// Outputs: total number of deadline misses since OS_Init
+uint32_t OS_DeadlineMisses(void){
+  return DeadlineMisses;
+}
+
 // ******** OS_InitSemaphore ************
 // Initialize counting semaphore
 // Inputs:  pointer to a semaphore
 //          initial value of semaphore
 // Outputs: none
-void OS_InitSemaphore(int32_t *semaPt, int32_t value){
-  (*semaPt) = value;
+void OS_InitSemaphore(semaType *semaPt, int32_t value){
+  semaPt->value = value;
+  semaPt->head = NULL;   // no threads blocked
+  semaPt->tail = NULL;
 }
 
 // ******** OS_Wait ************
@@ -243,18 +1148,63 @@ void OS_InitSemaphore(int32_t *semaPt, int32_t value){
 // Lab3 block if less than zero
 // Inputs:  pointer to a counting semaphore
 // Outputs: none
-void OS_Wait(int32_t *semaPt){
-  DisableInterrupts();
+void OS_Wait(semaType *semaPt){
+  long sr = KernelEnter();
+  TRACEPOINT(TRACE_WAIT, TRACEID(RunPt), TRACESEMA(semaPt));
 
-  (*semaPt) = (*semaPt) - 1;
+  semaPt->value = semaPt->value - 1;
 
-  if ((*semaPt) < 0) {
-    RunPt->semaPt = semaPt;
-    EnableInterrupts();
+  if (semaPt->value < 0) {
+    SemaBlock(semaPt, RunPt);
+    KernelExit(sr);
     OS_Suspend();
   }
 
-  EnableInterrupts();
+  KernelExit(sr);
+}
+
+// ******** OS_WaitTimeout ************
+// Decrement semaphore, blocking for at most timeout ms if
+// less than zero; whichever comes first, OS_Signal or the
+// timeout, makes the thread ready again
+// Inputs:  pointer to a counting semaphore
+//          number of msec to wait, 0 to never block (OS_TryWait)
+// Outputs: 1 if the semaphore was taken, 0 if the time ran out
+int OS_WaitTimeout(semaType *semaPt, uint32_t timeout){
+  long sr;
+  if (timeout == 0) {
+    return OS_TryWait(semaPt);
+  }
+  sr = KernelEnter();
+  TRACEPOINT(TRACE_WAIT, TRACEID(RunPt), TRACESEMA(semaPt));
+  semaPt->value = semaPt->value - 1;
+  if (semaPt->value >= 0) {
+    KernelExit(sr);
+    return 1;
+  }
+  SemaBlock(semaPt, RunPt);
+  RunPt->timedOut = 0;
+  RunPt->sleep = timeout;      // also on the sleeping list
+  SleepInsert(RunPt, timeout);
+  KernelExit(sr);
+  OS_Suspend();                // OS_Signal or runperiodicevents wakes it
+  return RunPt->timedOut == 0;
+}
+
+// ******** OS_TryWait ************
+// Decrement a semaphore only if that does not block
+// Inputs:  pointer to a counting semaphore
+// Outputs: 1 if decremented, 0 if it was not positive
+// Can be called from an ISR
+int OS_TryWait(semaType *semaPt){
+  int ok = 0;
+  long sr = KernelEnter();
+  if(semaPt->value > 0){   // positive means no thread is blocked
+    semaPt->value = semaPt->value - 1;
+    ok = 1;
+  }
+  KernelExit(sr);
+  return ok;
 }
 
 // ******** OS_Signal ************
@@ -263,28 +1213,693 @@ void OS_Wait(int32_t *semaPt){
 // Lab3 wakeup blocked thread if appropriate
 // Inputs:  pointer to a counting semaphore
 // Outputs: none
-void OS_Signal(int32_t *semaPt){
-  DisableInterrupts();
-	tcbType *cur;
-  (*semaPt) = (*semaPt) + 1;
+void OS_Signal(semaType *semaPt){
+  tcbType *cur;
+#if SEMARING
+  uint32_t i;
+#endif
+  long sr = KernelEnter();
+  semaPt->value = semaPt->value + 1;
+
+  if (semaPt->value <= 0) {
+#if SEMARING
+    // search the TCB ring from the thread after RunPt, kernel
+    // threads are not on it and start at the first thread
+    cur = ((RunPt >= tcbs)&&(RunPt < &tcbs[NumThreads])) ? RunPt->next : &tcbs[0];
+    for(i=0; (i<NumThreads)&&(cur->semaPt!=semaPt); i++){
+      cur = cur->next;
+    }
+#if WORKQUEUE
+    if(cur->semaPt != semaPt){
+      cur = &WorkerTcb;     // the only kernel thread that waits
+    }
+#endif
+#else
+    // wake up the thread that has been blocked the longest
+    cur = semaPt->head;
+    semaPt->head = cur->nextBlocked;
+#endif
+    cur->semaPt = NULL;
+    if (cur->sleep) {
+      SleepRemove(cur);     // in OS_WaitTimeout, signaled in time
+    }
+    ReadyAdd(cur);
+    TRACEPOINT(TRACE_SIGNAL, TRACEID(cur), TRACESEMA(semaPt));
+    if (Beats(cur, RunPt)) {
+      INTCTRL = 0x10000000; // trigger PendSV, runs when no ISR is active
+    }
+  } else {
+    TRACEPOINT(TRACE_SIGNAL, TRACE_NOTHREAD, TRACESEMA(semaPt));
+  }
+
+  KernelExit(sr);
+}
+
+// ******** IsReady ************
+// Inputs:  thread
+// Outputs: 1 if it is in the ready structures, running or not
+int static IsReady(tcbType *thread){
+  return (thread->sleep == 0)&&(thread->semaPt == NULL)&&
+         (thread->mutexPt == NULL)&&(thread->flagsPt == NULL);
+}
+
+// ******** SetPriority ************
+// Change the priority a thread runs at, moving it to the
+// ready list for its new priority if it is ready
+// Inputs:  thread
+//          new priority
+// Outputs: none
+// Must be called with interrupts disabled
+void static SetPriority(tcbType *thread, uint32_t priority){
+  if(thread->priority == priority){
+    return;
+  }
+  if(IsReady(thread)&&(!TIMED(thread))){ // ordered by priority
+    ReadyUnlink(thread);
+    thread->priority = priority;
+    ReadyLink(thread);
+  } else{
+    thread->priority = priority;
+  }
+}
+
+#if EDF
+// ******** SetInherited ************
+// Give a thread the deadline of a thread blocked on a mutex it
+// owns, or take it away, moving it in or out of the deadline
+// heap, or up or down it, if it is ready
+// Inputs:  thread
+//          1 to inherit, 0 to go back to its own deadline if any
+//          absolute deadline to inherit
+// Outputs: none
+// Must be called with interrupts disabled
+void static SetInherited(tcbType *thread, uint32_t inherited, uint32_t deadline){
+  if(IsReady(thread)&&(TIMED(thread) != (thread->relDeadline || inherited))){
+    ReadyUnlink(thread);                 // between the heap and a list
+    thread->inherited = inherited;
+    thread->waiterDeadline = deadline;
+    ReadyLink(thread);
+    return;
+  }
+  thread->inherited = inherited;
+  thread->waiterDeadline = deadline;
+  if(TIMED(thread)){
+    thread->deadline = EffectiveDeadline(thread);
+    if(IsReady(thread)){
+      HeapMove(thread->heapIndex);
+    }
+  }
+}
+#endif
+
+// ******** MutexInsert ************
+// Put a thread into the list of threads blocked on a mutex,
+// after the ones that would run before it or at the same time
+// Inputs:  mutex
+//          thread to block
+// Outputs: none
+// Must be called with interrupts disabled
+void static MutexInsert(mutexType *mutexPt, tcbType *thread){
+  tcbType **pt = &mutexPt->head;
+  while((*pt != NULL)&&(!Beats(thread, *pt))){
+    pt = &(*pt)->nextBlocked;
+  }
+  thread->nextBlocked = *pt;
+  *pt = thread;
+}
+
+// ******** MutexRemove ************
+// Take a thread out of the list of threads blocked on a mutex
+// Inputs:  mutex
+//          thread blocked on it
+// Outputs: none
+// Must be called with interrupts disabled
+void static MutexRemove(mutexType *mutexPt, tcbType *thread){
+  tcbType **pt = &mutexPt->head;
+  while(*pt != thread){
+    pt = &(*pt)->nextBlocked;
+  }
+  *pt = thread->nextBlocked;
+}
+
+// ******** Inherit ************
+// Set the priority of a thread from its base priority and the
+// threads blocked on the mutexes it owns, and in EDF mode its
+// inherited deadline from the earliest of those with a deadline
+// Inputs:  thread
+// Outputs: none
+// Must be called with interrupts disabled
+void static Inherit(tcbType *thread){
+  mutexType *m;
+  tcbType *w;
+  uint32_t priority = thread->basePriority;
+#if EDF
+  tcbType *timed = NULL;
+#endif
+  for(m = thread->held; m != NULL; m = m->nextHeld){
+    w = m->head;           // sorted, so threads with deadlines come first
+#if EDF
+    if((w != NULL)&&TIMED(w)&&((timed == NULL)||Earlier(w, timed))){
+      timed = w;
+    }
+    while((w != NULL)&&TIMED(w)){
+      w = w->nextBlocked;  // first one without a deadline
+    }
+#endif
+    if((w != NULL)&&(w->priority < priority)){
+      priority = w->priority;
+    }
+  }
+  SetPriority(thread, priority);
+#if EDF
+  SetInherited(thread, timed != NULL, (timed != NULL) ? timed->deadline : 0);
+#endif
+}
+
+// ******** OS_InitMutex ************
+// Initialize mutex as free
+// Inputs:  pointer to a mutex
+// Outputs: none
+void OS_InitMutex(mutexType *mutexPt){
+  mutexPt->owner = NULL;
+  mutexPt->head = NULL;  // no threads blocked
+  mutexPt->nextHeld = NULL;
+}
+
+// ******** OS_Lock ************
+// Take ownership of the mutex, block if another thread owns it
+// The owner inherits the priority of the thread that blocks, or
+// in EDF mode its deadline, and so on down a chain of owners
+// blocked on other mutexes. The job of a thread with a deadline
+// goes on while it waits.
+// Inputs:  pointer to a mutex
+// Outputs: none
+// A thread must not lock a mutex it already owns
+void OS_Lock(mutexType *mutexPt){
+  tcbType *owner;
+  long sr = KernelEnter();
+  if(mutexPt->owner == NULL){
+    mutexPt->owner = RunPt;
+    mutexPt->nextHeld = RunPt->held;
+    RunPt->held = mutexPt;
+    KernelExit(sr);
+    return;
+  }
+  RunPt->mutexPt = mutexPt;
+  MutexInsert(mutexPt, RunPt);
+  ReadyUnlink(RunPt);      // same job when it gets the mutex
+  owner = mutexPt->owner;
+  while(Beats(RunPt, owner)){
+#if EDF
+    if(TIMED(RunPt)){
+      SetInherited(owner, 1, RunPt->deadline);
+    } else
+#endif
+    SetPriority(owner, RunPt->priority);
+    if(owner->mutexPt == NULL){
+      break;               // owner is ready, sleeping or on a semaphore or flags
+    }
+    MutexRemove(owner->mutexPt, owner); // keep its wait list sorted
+    MutexInsert(owner->mutexPt, owner);
+    owner = owner->mutexPt->owner;
+  }
+  KernelExit(sr);
+  OS_Suspend();            // OS_Unlock makes this thread the owner
+}
+
+// ******** OS_Unlock ************
+// Give up ownership of the mutex, the blocked thread that
+// would run first becomes the owner
+// Inputs:  pointer to a mutex owned by this thread
+// Outputs: none
+void OS_Unlock(mutexType *mutexPt){
+  tcbType *cur;
+  mutexType **pt;
+  long sr = KernelEnter();
+  if(mutexPt->owner != RunPt){
+    KernelExit(sr);
+    return;                // not the owner, nothing to do
+  }
+  pt = &RunPt->held;
+  while(*pt != mutexPt){
+    pt = &(*pt)->nextHeld;
+  }
+  *pt = mutexPt->nextHeld;
+  // drop back to what the threads still waiting on mutexes we own need
+  Inherit(RunPt);
+  cur = mutexPt->head;
+  if(cur != NULL){
+    // hand over to the thread at the head, it goes on with its job
+    mutexPt->head = cur->nextBlocked;
+    cur->mutexPt = NULL;
+    mutexPt->owner = cur;
+    mutexPt->nextHeld = cur->held;
+    cur->held = mutexPt;
+    cur->sliceLeft = cur->quantum;
+    ReadyLink(cur);
+  } else{
+    mutexPt->owner = NULL;
+  }
+  if(Beats(BestReady(), RunPt)){
+    INTCTRL = 0x10000000;  // trigger PendSV, a higher priority thread is ready
+  }
+  KernelExit(sr);
+}
+
+// ******** FlagsMatch ************
+// Check a thread's wait condition against the flags of its group
+// Inputs:  thread blocked on flags, or about to block
+//          flags that are set
+// Outputs: flags that end the wait, 0 if it must keep waiting
+uint32_t static FlagsMatch(tcbType *thread, uint32_t value){
+  uint32_t got = value&thread->flagsMask;
+  if(thread->flagsAll && (got != thread->flagsMask)){
+    return 0;
+  }
+  return got;
+}
+
+// ******** OS_InitFlags ************
+// Initialize an event flag group
+// Inputs:  pointer to a flag group
+//          flags initially set
+// Outputs: none
+void OS_InitFlags(flagsType *flagsPt, uint32_t value){
+  flagsPt->value = value;
+  flagsPt->head = NULL;  // no threads blocked
+  flagsPt->tail = NULL;
+}
+
+// ******** OS_WaitFlags ************
+// Block until any or all of a set of flags are set
+// Inputs:  pointer to a flag group
+//          flags to wait for, not 0
+//          FLAGS_ANY to wake up when one of them is set,
+//          FLAGS_ALL to wait until all of them are set
+//          nonzero to clear the flags that ended the wait
+// Outputs: the flags in the mask that were set
+uint32_t OS_WaitFlags(flagsType *flagsPt, uint32_t mask, uint32_t mode, int clear){
+  uint32_t got;
+  long sr = KernelEnter();
+  TRACEPOINT(TRACE_WAIT, TRACEID(RunPt), TRACESEMA(flagsPt));
+  RunPt->flagsMask = mask;
+  RunPt->flagsAll = (mode == FLAGS_ALL);
+  RunPt->flagsClear = (clear != 0);
+  got = FlagsMatch(RunPt, flagsPt->value);
+  if(got){
+    if(clear){
+      flagsPt->value &= ~got;
+    }
+    KernelExit(sr);
+    return got;
+  }
+  RunPt->flagsPt = flagsPt;
+  // add to the end of the list of blocked threads
+  RunPt->nextBlocked = NULL;
+  if(flagsPt->head == NULL){
+    flagsPt->head = RunPt;
+  } else{
+    flagsPt->tail->nextBlocked = RunPt;
+  }
+  flagsPt->tail = RunPt;
+  ReadyRemove(RunPt);
+  KernelExit(sr);
+  OS_Suspend();            // OS_SetFlags fills in flagsGot
+  return RunPt->flagsGot;
+}
+
+// ******** OS_SetFlags ************
+// Set flags in a group and wake up the threads they satisfy,
+// in the order they started waiting. A thread that waits with
+// clear takes its flags, so threads after it may not see them.
+// Can be called from an ISR
+// Inputs:  pointer to a flag group
+//          flags to set
+// Outputs: none
+// Takes time proportional to the number of blocked threads
+void OS_SetFlags(flagsType *flagsPt, uint32_t flags){
+  tcbType *cur,*prev;
+  uint32_t got;
+  long sr = KernelEnter();
+  flagsPt->value |= flags;
+  prev = NULL;
+  cur = flagsPt->head;
+  while(cur != NULL){
+    got = FlagsMatch(cur, flagsPt->value);
+    if(got == 0){
+      prev = cur;
+      cur = cur->nextBlocked;
+      continue;
+    }
+    // remove from the blocked list and make it ready
+    if(prev == NULL){
+      flagsPt->head = cur->nextBlocked;
+    } else{
+      prev->nextBlocked = cur->nextBlocked;
+    }
+    if(flagsPt->tail == cur){
+      flagsPt->tail = prev;
+    }
+    if(cur->flagsClear){
+      flagsPt->value &= ~got;
+    }
+    cur->flagsGot = got;
+    cur->flagsPt = NULL;
+    ReadyAdd(cur);
+    TRACEPOINT(TRACE_SIGNAL, TRACEID(cur), TRACESEMA(flagsPt));
+    if(Beats(cur, RunPt)){
+      INTCTRL = 0x10000000; // trigger PendSV, runs when no ISR is active
+    }
+    cur = cur->nextBlocked;
+  }
+  KernelExit(sr);
+}
+
+// ******** OS_ClearFlags ************
+// Clear flags in a group, no thread wakes up
+// Inputs:  pointer to a flag group
+//          flags to clear
+// Outputs: none
+void OS_ClearFlags(flagsType *flagsPt, uint32_t flags){
+  long sr = KernelEnter();
+  flagsPt->value &= ~flags;
+  KernelExit(sr);
+}
+
+// ******** QueueCopy ************
+// Copy one or more queue elements
+// Inputs:  destination, source, number of bytes
+// Outputs: none
+void static QueueCopy(uint8_t *dest, const uint8_t *src, uint32_t n){
+  while(n){
+    *dest = *src;
+    dest++; src++; n--;
+  }
+}
+
+// ******** QueueIn ************
+// Copy one element into a queue that has room for it
+// Inputs:  queue, element
+// Outputs: none
+// The caller owns one count of spaces
+void static QueueIn(queueType *queuePt, const uint8_t *data){
+  long sr = KernelEnter();  // producers fill the slots in order
+  QueueCopy(&queuePt->buffer[queuePt->putI*queuePt->size], data, queuePt->size);
+  queuePt->putI = queuePt->putI+1;
+  if(queuePt->putI == queuePt->depth){
+    queuePt->putI = 0;
+  }
+  KernelExit(sr);
+  OS_Signal(&queuePt->items);
+}
+
+// ******** QueueOut ************
+// Copy the oldest element out of a queue
+// Inputs:  queue, place for the element
+// Outputs: none
+// The caller owns one count of items
+void static QueueOut(queueType *queuePt, uint8_t *data){
+  long sr = KernelEnter();
+  QueueCopy(data, &queuePt->buffer[queuePt->getI*queuePt->size], queuePt->size);
+  queuePt->getI = queuePt->getI+1;
+  if(queuePt->getI == queuePt->depth){
+    queuePt->getI = 0;
+  }
+  KernelExit(sr);
+  OS_Signal(&queuePt->spaces);
+}
+
+// ******** OS_Queue_Init ************
+// Initialize an empty queue in storage given by the caller
+// Inputs:  pointer to a queue
+//          storage for depth elements of size bytes each
+//          size of one element in bytes
+//          maximum number of elements
+// Outputs: none
+void OS_Queue_Init(queueType *queuePt, void *buffer, uint32_t size, uint32_t depth){
+  queuePt->buffer = buffer;
+  queuePt->size = size;
+  queuePt->depth = depth;
+  queuePt->putI = 0;
+  queuePt->getI = 0;
+  queuePt->lost = 0;
+  OS_InitSemaphore(&queuePt->items, 0);
+  OS_InitSemaphore(&queuePt->spaces, depth);
+}
+
+// ******** OS_Queue_Put ************
+// Copy one element into a queue
+// Inputs:  pointer to a queue
+//          element to copy, size bytes
+//          nonzero to wait for room, 0 to return at once
+// Outputs: 1 if stored, 0 if the queue was full (counted in lost)
+// Can be called from an ISR with block 0
+int OS_Queue_Put(queueType *queuePt, const void *data, int block){
+  if(block){
+    OS_Wait(&queuePt->spaces);
+  } else if(OS_TryWait(&queuePt->spaces) == 0){
+    queuePt->lost = queuePt->lost+1;
+    return 0;
+  }
+  QueueIn(queuePt, data);
+  return 1;
+}
+
+// ******** OS_Queue_Get ************
+// Copy the oldest element out of a queue
+// Inputs:  pointer to a queue
+//          place for the element, size bytes
+//          nonzero to wait for data, 0 to return at once
+// Outputs: 1 if an element was copied, 0 if the queue was empty
+// Can be called from an ISR with block 0
+int OS_Queue_Get(queueType *queuePt, void *data, int block){
+  if(block){
+    OS_Wait(&queuePt->items);
+  } else if(OS_TryWait(&queuePt->items) == 0){
+    return 0;
+  }
+  QueueOut(queuePt, data);
+  return 1;
+}
+
+// ******** OS_Queue_PutBatch ************
+// Copy several elements into a queue, in order
+// Inputs:  pointer to a queue
+//          array of n elements
+//          number of elements
+//          nonzero to wait until all n are stored, 0 to store
+//          as many as fit now
+// Outputs: number of elements stored
+// With block 0 the elements that did not fit are counted in lost
+uint32_t OS_Queue_PutBatch(queueType *queuePt, const void *data, uint32_t n, int block){
+  const uint8_t *pt = data;
+  uint32_t i;
+  for(i=0; i<n; i++){
+    if(OS_Queue_Put(queuePt, pt, block) == 0){
+      queuePt->lost = queuePt->lost+n-i-1; // this one is counted already
+      break;
+    }
+    pt = pt+queuePt->size;
+  }
+  return i;
+}
+
+// ******** OS_Queue_GetBatch ************
+// Copy several elements out of a queue, oldest first
+// Inputs:  pointer to a queue
+//          place for n elements
+//          number of elements
+//          nonzero to wait until n are copied, 0 to copy
+//          the ones there now
+// Outputs: number of elements copied
+uint32_t OS_Queue_GetBatch(queueType *queuePt, void *data, uint32_t n, int block){
+  uint8_t *pt = data;
+  uint32_t i;
+  for(i=0; i<n; i++){
+    if(OS_Queue_Get(queuePt, pt, block) == 0){
+      break;
+    }
+    pt = pt+queuePt->size;
+  }
+  return i;
+}
+
+// ******** OS_Queue_Count ************
+// Number of elements in a queue
+// Inputs:  pointer to a queue
+// Outputs: elements waiting to be read
+uint32_t OS_Queue_Count(queueType *queuePt){
+  int32_t value = queuePt->items.value;
+  return (value > 0) ? value : 0;
+}
+
+// ******** OS_Ring_Init ************
+// Initialize an empty single producer, single consumer ring
+// Inputs:  pointer to a ring
+//          storage for depth elements of size bytes each
+//          size of one element in bytes
+//          maximum number of elements, a power of 2
+//          semaphore to wake up a blocked consumer, NULL if the
+//          consumer only polls; initialized here
+// Outputs: 1 if successful, 0 if depth is not a power of 2
+int OS_Ring_Init(ringType *ringPt, void *buffer, uint32_t size, uint32_t depth, semaType *wake){
+  if((depth == 0)||(depth&(depth-1))){
+    return 0;
+  }
+  ringPt->buffer = buffer;
+  ringPt->size = size;
+  ringPt->mask = depth-1;
+  ringPt->putI = 0;
+  ringPt->getI = 0;
+  ringPt->waiting = 0;
+  ringPt->lost = 0;
+  ringPt->wake = wake;
+  if(wake){
+    OS_InitSemaphore(wake, 0);
+  }
+  return 1;
+}
 
-  if ((*semaPt <= 0)) {
-		cur = RunPt->next;
-		while (cur->semaPt != semaPt) {
-			cur = cur->next;
-		}
-		cur->semaPt = NULL;
+// ******** OS_Ring_Put ************
+// Copy one element into a ring, never waits
+// Only putI is written, after the element, so the consumer never
+// sees a half written element and interrupts stay enabled.
+// The wake semaphore is signaled only if the consumer is blocked.
+// Inputs:  pointer to a ring
+//          element to copy, size bytes
+// Outputs: 1 if stored, 0 if the ring was full (counted in lost)
+// Only one thread or ISR may put into a ring
+int OS_Ring_Put(ringType *ringPt, const void *data){
+  uint32_t putI = ringPt->putI;
+  volatile uint8_t *dest;
+  const uint8_t *src = data;
+  uint32_t n = ringPt->size;
+  if(putI-ringPt->getI > ringPt->mask){
+    ringPt->lost = ringPt->lost+1;
+    return 0;              // full
   }
+  dest = &ringPt->buffer[(putI&ringPt->mask)*n];
+  while(n){
+    *dest = *src;
+    dest++; src++; n--;
+  }
+  ringPt->putI = putI+1;   // publish
+  if(ringPt->waiting){
+    ringPt->waiting = 0;
+    OS_Signal(ringPt->wake);
+  }
+  return 1;
+}
 
-  EnableInterrupts();
+// ******** OS_Ring_Get ************
+// Copy the oldest element out of a ring
+// Inputs:  pointer to a ring
+//          place for the element, size bytes
+//          nonzero to block until there is one (needs a wake
+//          semaphore), 0 to return at once
+// Outputs: 1 if an element was copied, 0 if the ring was empty
+// Only one thread may get from a ring
+int OS_Ring_Get(ringType *ringPt, void *data, int block){
+  uint32_t getI = ringPt->getI;
+  volatile uint8_t *src;
+  uint8_t *dest = data;
+  uint32_t n = ringPt->size;
+  while(ringPt->putI == getI){
+    if((block == 0)||(ringPt->wake == NULL)){
+      return 0;            // empty
+    }
+    ringPt->waiting = 1;
+    if(ringPt->putI == getI){ // the producer may have put one in between
+      OS_Wait(ringPt->wake);
+    }
+    ringPt->waiting = 0;   // a signal left over makes the loop run once more
+  }
+  src = &ringPt->buffer[(getI&ringPt->mask)*n];
+  while(n){
+    *dest = *src;
+    dest++; src++; n--;
+  }
+  ringPt->getI = getI+1;   // free the element
+  return 1;
+}
+
+// ******** OS_Ring_Count ************
+// Number of elements in a ring
+// Inputs:  pointer to a ring
+// Outputs: elements waiting to be read
+uint32_t OS_Ring_Count(ringType *ringPt){
+  return ringPt->putI-ringPt->getI;
+}
+
+#if WORKQUEUE
+//****work queue************
+// ISRs hand the slow part of their work to the kernel's work queue
+// thread, so they stay short and keep interrupts at their priority
+// enabled for only a few dozen cycles; the thread runs at
+// DEFERPRIORITY, so threads at a higher priority delay the jobs
+
+// ******** Worker ************
+// The kernel's work queue thread, runs the jobs posted with
+// OS_Defer in the order they were posted, all that are waiting
+// in one batch, then blocks until another one is posted
+// Inputs:  none
+// Outputs: none (never returns)
+void static Worker(void){
+  struct job job;
+  long sr;
+  while(1){
+    sr = KernelEnter();
+    while(DeferGetI == DeferPutI){ // empty
+      DeferWaiting = 1;
+      KernelExit(sr);
+      OS_Wait(&DeferReady);
+      sr = KernelEnter();
+    }
+    job = DeferJobs[DeferGetI&(DEFERSIZE-1)];
+    DeferGetI++;
+    KernelExit(sr);
+    job.function(job.arg);     // with interrupts enabled
+    DeferRuns++;
+  }
 }
 
+// ******** OS_Defer ************
+// Post a job for the work queue thread to run, never waits
+// The thread is signaled only if it is blocked, so posting a
+// burst of jobs costs one OS_Signal
+// Inputs:  function to run in the work queue thread
+//          argument to pass to it
+// Outputs: 1 if posted, 0 if the queue was full (counted in DeferLost)
+// Can be called from any thread or ISR below KERNELCEILING
+int OS_Defer(void(*function)(uint32_t), uint32_t arg){
+  uint32_t n;
+  long sr = KernelEnter();
+  n = DeferPutI-DeferGetI;
+  if(n == DEFERSIZE){
+    DeferLost++;
+    KernelExit(sr);
+    return 0;                  // full
+  }
+  DeferJobs[DeferPutI&(DEFERSIZE-1)].function = function;
+  DeferJobs[DeferPutI&(DEFERSIZE-1)].arg = arg;
+  DeferPutI++;
+  if(n+1 > DeferMax){
+    DeferMax = n+1;
+  }
+  if(DeferWaiting){
+    DeferWaiting = 0;
+    OS_Signal(&DeferReady);
+  }
+  KernelExit(sr);
+  return 1;
+}
+#endif
+
+// the OS FIFO of Labs 2 and 3 is a queue of FSIZE words,
+// kept for the Lab 4 steps that still use it
 #define FSIZE 10    // can be any size
-uint32_t PutI;      // index of where to put next
-uint32_t GetI;      // index of where to get next
 uint32_t Fifo[FSIZE];
-int32_t CurrentSize;// 0 means FIFO empty, FSIZE means full
-uint32_t LostData;  // number of lost pieces of data
+queueType FifoQueue;
 
 // ******** OS_FIFO_Init ************
 // Initialize FIFO.  The "put" and "get" indices initially
@@ -296,13 +1911,7 @@ uint32_t LostData;  // number of lost pieces of data
 // Inputs:  none
 // Outputs: none
 void OS_FIFO_Init(void){
-  // init pointers
-  PutI = 0;
-  GetI = 0;
-  // no lost data
-  LostData = 0;
-  // fifo is available
-  OS_InitSemaphore(&CurrentSize, 0);
+  OS_Queue_Init(&FifoQueue, Fifo, sizeof(uint32_t), FSIZE);
 }
 
 // ******** OS_FIFO_Put ************
@@ -313,15 +1922,9 @@ void OS_FIFO_Init(void){
 // Inputs:  data to be stored
 // Outputs: 0 if successful, -1 if the FIFO is full
 int OS_FIFO_Put(uint32_t data){
-  if (CurrentSize == FSIZE) {
-    LostData++;
+  if(OS_Queue_Put(&FifoQueue, &data, 0) == 0){
     return -1; // queue is full
   }
-
-  Fifo[PutI] = data;
-  PutI = (PutI + 1) % FSIZE;
-  OS_Signal(&CurrentSize);
-
   return 0;   // success
 }
 
@@ -333,131 +1936,870 @@ int OS_FIFO_Put(uint32_t data){
 // Inputs:  none
 // Outputs: data retrieved
 uint32_t OS_FIFO_Get(void){
-	uint32_t data;
-  OS_Wait(&CurrentSize);
-
-  data = Fifo[GetI];
-  GetI = (GetI + 1) % FSIZE;
-
+  uint32_t data;
+  OS_Queue_Get(&FifoQueue, &data, 1);
   return data;
 }
 
 // *****periodic events****************
-int32_t *PeriodicSemaphore0;
-uint32_t Period0; // time between signals
-int32_t *PeriodicSemaphore1;
-uint32_t Period1; // time between signals
+// each periodic trigger signals its semaphore every period ms;
+// triggers are sorted by next release time, and each one stores
+// the number of ms after the one before it (delta list), so a
+// tick only counts down the first one
+struct release {
+  semaType *semaPt;          // semaphore to signal, or NULL
+  flagsType *flagsPt;        // else flag group to set
+  uint32_t flags;
+  uint32_t period;           // time between signals
+  uint32_t delta;            // ms after the release before it
+  struct release *next;
+};
+typedef struct release releaseType;
+releaseType Releases[NUMPERIODIC];
+uint32_t NumReleases;        // Releases[0] to Releases[NumReleases-1] are in use
+releaseType *ReleasePt;      // next release due, NULL if none
+void (*Sampler)(void);       // run every 1 ms at priority 0, see OS_Sampler_Init
+uint32_t ReleaseTicks;       // 1 ms ticks counted, only RealTimeEvents writes it
+uint32_t ReleaseDone;        // ticks WideTimer3B_Handler has handled, only it writes it
+
+// ******** ReleaseInsert ************
+// Put a periodic trigger into the sorted release list
+// Inputs:  trigger
+//          number of ms until it is due, greater than zero
+// Outputs: none
+// Must be called with WideTimer3B_Handler unable to run
+void static ReleaseInsert(releaseType *release, uint32_t time){
+  releaseType *cur = ReleasePt;
+  releaseType *prev = NULL;
+  while (cur && (cur->delta <= time)) {
+    time = time - cur->delta;     // equal times stay in FIFO order
+    prev = cur;
+    cur = cur->next;
+  }
+  release->delta = time;
+  release->next = cur;
+  if (cur) {
+    cur->delta = cur->delta - time;
+  }
+  if (prev) {
+    prev->next = release;
+  } else {
+    ReleasePt = release;
+  }
+}
+
+// ******** RealTimeEvents ************
+// The 1 ms Wide Timer 3A interrupt, at priority 0 so the kernel
+// never delays it; it runs the sampler, then leaves the periodic
+// triggers to the kernel aware Wide Timer 3B interrupt, which it
+// pends in software
+// Inputs:  none
+// Outputs: none
 void RealTimeEvents(void) {
-  int flag=0;
-  static int32_t realCount = -10; // let all the threads execute once
-  // Note to students: we had to let the system run for a time so all user threads ran at least one
-  // before signalling the periodic tasks
-  realCount++;
-  if(realCount >= 0){
-		if((realCount%Period0)==0){
-      OS_Signal(PeriodicSemaphore0);
-      flag = 1;
-		}
-    if((realCount%Period1)==0){
-      OS_Signal(PeriodicSemaphore1);
-      flag=1;
-		}
-    if(flag){
-      OS_Suspend();
-    }
-  }
-}
-// ******** OS_PeriodTrigger0_Init ************
-// Initialize periodic timer interrupt to signal
-// Inputs:  semaphore to signal
-//          period in ms
-// priority level at 0 (highest
+  if (Sampler) {
+    Sampler();                    // same point of every ms
+  }
+  ReleaseTicks++;
+  NVIC_SW_TRIG_R = 101;           // pend Wide Timer 3B, IRQ 101
+}
+
+// ******** WideTimer3B_Handler ************
+// Signal the periodic triggers due on the ticks RealTimeEvents
+// counted, at priority KERNELCEILING; Wide Timer 3B itself is
+// never started, only pended by RealTimeEvents
+// Inputs:  none
 // Outputs: none
-void OS_PeriodTrigger0_Init(int32_t *semaPt, uint32_t period){
-	PeriodicSemaphore0 = semaPt;
-	Period0 = period;
-	BSP_PeriodicTask_InitC(&RealTimeEvents,1000,0);
+void WideTimer3B_Handler(void) {
+  releaseType *cur;
+  TRACEPOINT(TRACE_ISRENTER, TRACEID(RunPt), 117); // WideTimer3B
+  while (ReleaseDone != ReleaseTicks) {
+    ReleaseDone++;                // one tick at a time, in case one was late
+    if (ReleasePt == NULL) {
+      continue;
+    }
+    ReleasePt->delta--;
+    while (ReleasePt->delta == 0) {
+      cur = ReleasePt;            // due now
+      ReleasePt = cur->next;
+      // OS_Signal triggers PendSV if the released thread has higher priority,
+      // the switch happens right after this ISR without resetting the time slice
+      if (cur->semaPt) {
+        TRACEPOINT(TRACE_RELEASE, TRACEID(RunPt), TRACESEMA(cur->semaPt));
+        OS_Signal(cur->semaPt);
+      } else {
+        TRACEPOINT(TRACE_RELEASE, TRACEID(RunPt), TRACESEMA(cur->flagsPt));
+        OS_SetFlags(cur->flagsPt, cur->flags);
+      }
+      ReleaseInsert(cur, cur->period);
+    }
+  }
+  TRACEPOINT(TRACE_ISREXIT, TRACEID(RunPt), 117);
 }
-// ******** OS_PeriodTrigger1_Init ************
-// Initialize periodic timer interrupt to signal
+
+// ******** NextRelease ************
+// Number of 1 ms ticks until RealTimeEvents must run next
+// Inputs:  none
+// Outputs: 1 to MAXIDLE, 0 if no periodic triggers or sampler
+uint32_t static NextRelease(void){
+  if (Sampler || (ReleaseDone != ReleaseTicks)) {
+    return 1;                        // every tick, or one not handled yet
+  }
+  if (ReleasePt == NULL) {
+    return 0;                        // RealTimeEvents not running
+  }
+  if (ReleasePt->delta > MAXIDLE) {
+    return MAXIDLE;
+  }
+  return ReleasePt->delta;
+}
+
+// ******** ReleaseSkip ************
+// Count 1 ms ticks that passed without running RealTimeEvents
+// Inputs:  number of ticks, less than NextRelease()
+// Outputs: none
+// Must be called with interrupts disabled
+void static ReleaseSkip(uint32_t ticks){
+  ReleasePt->delta = ReleasePt->delta - ticks;
+}
+
+// ******** ReleaseTimer_Init ************
+// Start the 1 ms interrupt shared by the periodic triggers and
+// the sampler, the first time one of them is added
+// Inputs:  none
+// Outputs: none
+void static ReleaseTimer_Init(void){
+  if ((NumReleases > 0) || Sampler) {
+    return;                          // already running
+  }
+  ReleasePt = NULL;
+  ReleaseTicks = 0;
+  ReleaseDone = 0;
+// Wide Timer 3B: vector number 117, interrupt number 101, bits 15:13 of PRI25
+  NVIC_PRI25_R = (NVIC_PRI25_R&0xFFFF00FF)|(KERNELCEILING<<13); // highest that may signal
+  NVIC_EN3_R = 1<<5;                 // enable IRQ 101 in NVIC
+  BSP_PeriodicTask_InitC(&RealTimeEvents,1000,0); // never delayed by the kernel
+}
+
+// ******** OS_Sampler_Init ************
+// Run a function every 1 ms from RealTimeEvents, before the
+// periodic triggers due on the same tick are signaled
+// Inputs:  function to run, NULL to stop
+// Outputs: none
+// The function must not call any OS_ function except OS_Ring_Put
+// on a ring without a wake semaphore
+void OS_Sampler_Init(void(*sampler)(void)){
+  if (sampler) {
+    ReleaseTimer_Init();
+  }
+  Sampler = sampler;
+}
+
+// ******** OS_PeriodTrigger_Init ************
+// Signal a semaphore periodically, from a 1 ms software interrupt
+// at priority KERNELCEILING shared by all periodic triggers
 // Inputs:  semaphore to signal
-//          period in ms
-// priority level at 0 (highest
+//          period in ms, greater than zero
+//          phase, ms until the first signal, 0 for one period
+// Outputs: 1 if successful, 0 if there are too many triggers
+// Give triggers different phases so they are not due on the same tick
+int OS_PeriodTrigger_Init(semaType *semaPt, uint32_t period, uint32_t phase){
+  return ReleaseAdd(semaPt, NULL, 0, period, phase);
+}
+
+// ******** OS_PeriodFlags_Init ************
+// Set event flags periodically, from the same 1 ms timer
+// interrupt as OS_PeriodTrigger_Init
+// Inputs:  flag group
+//          flags to set
+//          period in ms, greater than zero
+//          phase, ms until the first time, 0 for one period
+// Outputs: 1 if successful, 0 if there are too many triggers
+int OS_PeriodFlags_Init(flagsType *flagsPt, uint32_t flags, uint32_t period, uint32_t phase){
+  return ReleaseAdd(NULL, flagsPt, flags, period, phase);
+}
+
+// ******** ReleaseAdd ************
+// Start a periodic trigger, see OS_PeriodTrigger_Init
+// Inputs:  semaphore to signal, or NULL and the flags to set
+//          period and phase in ms
+// Outputs: 1 if successful, 0 if there are too many triggers
+int static ReleaseAdd(semaType *semaPt, flagsType *flagsPt, uint32_t flags,
+                      uint32_t period, uint32_t phase){
+  releaseType *release;
+  long status;
+  if ((period == 0) || (NumReleases == NUMPERIODIC)) {
+    return 0;
+  }
+  if (phase == 0) {
+    phase = period;
+  }
+  ReleaseTimer_Init();
+  status = KernelEnter();
+  release = &Releases[NumReleases];
+  NumReleases++;
+  release->semaPt = semaPt;
+  release->flagsPt = flagsPt;
+  release->flags = flags;
+  release->period = period;
+  ReleaseInsert(release, phase);
+  KernelExit(status);
+  return 1;
+}
+
+//****software timers************
+// any number of one-shot and auto-reload callbacks run from the
+// 1 ms tick (WideTimer4A, priority 5), so they cost no hardware
+// timer and no thread stack; active timers are sorted by expiry,
+// and each one stores the ms after the one before it (delta list)
+
+// ******** TimerInsert ************
+// Put a timer into the sorted list of active timers
+// Inputs:  timer
+//          number of ms until it expires, greater than zero
 // Outputs: none
-void OS_PeriodTrigger1_Init(int32_t *semaPt, uint32_t period){
-	PeriodicSemaphore1 = semaPt;
-	Period1 = period;
-	BSP_PeriodicTask_InitC(&RealTimeEvents,1000,0);
+// Must be called with interrupts disabled
+void static TimerInsert(timerType *timerPt, uint32_t time){
+  timerType *cur = TimerPt;
+  timerType *prev = NULL;
+  while (cur && (cur->delta <= time)) {
+    time = time - cur->delta;     // equal times run in FIFO order
+    prev = cur;
+    cur = cur->next;
+  }
+  timerPt->delta = time;
+  timerPt->next = cur;
+  if (cur) {
+    cur->delta = cur->delta - time;
+  }
+  if (prev) {
+    prev->next = timerPt;
+  } else {
+    TimerPt = timerPt;
+  }
+  timerPt->active = 1;
+}
+
+// ******** TimerRemove ************
+// Take an active timer out of the list
+// Inputs:  timer
+// Outputs: none
+// Must be called with interrupts disabled
+void static TimerRemove(timerType *timerPt){
+  timerType **pt = &TimerPt;
+  while (*pt != timerPt) {
+    pt = &(*pt)->next;
+  }
+  *pt = timerPt->next;
+  if (timerPt->next) {            // the next one waits for both deltas
+    timerPt->next->delta = timerPt->next->delta + timerPt->delta;
+  }
+  timerPt->active = 0;
+}
+
+// ******** TimerTick ************
+// Count down the first timer and run the callbacks that are due,
+// called every 1 ms from runperiodicevents
+// Callbacks run outside the kernel's critical section, and an
+// auto-reload timer is back in the list before its callback runs,
+// so the callback may stop or restart any timer
+// Inputs:  none
+// Outputs: none
+void static TimerTick(void){
+  timerType *cur;
+  long sr = KernelEnter();
+  if (TimerPt) {
+    TimerPt->delta--;
+  }
+  while (TimerPt && (TimerPt->delta == 0)) {
+    cur = TimerPt;                // expired
+    TimerPt = cur->next;
+    cur->active = 0;
+    if (cur->period) {
+      TimerInsert(cur, cur->period);
+    }
+    cur->count++;
+    KernelExit(sr);
+    cur->callback();
+    sr = KernelEnter();
+  }
+  KernelExit(sr);
+}
+
+// ******** OS_Timer_Start ************
+// Run a function once after delay ms, and then every period ms
+// if period is not zero; restarts the timer if it is active
+// Inputs:  timer, owned by the caller
+//          function to call, it runs in the 1 ms timer ISR so it
+//            must be short and must not block
+//          delay in ms until the first call, 0 for one period
+//          period in ms, 0 for a one-shot timer
+// Outputs: 1 if successful, 0 if both delay and period are 0
+// Can be called from an ISR or from a timer callback
+int OS_Timer_Start(timerType *timerPt, void(*callback)(void), uint32_t delay, uint32_t period){
+  long sr;
+  if (delay == 0) {
+    delay = period;
+  }
+  if (delay == 0) {
+    return 0;
+  }
+  sr = KernelEnter();
+  if (timerPt->active) {
+    TimerRemove(timerPt);
+  }
+  timerPt->callback = callback;
+  timerPt->period = period;
+  timerPt->count = 0;
+  TimerInsert(timerPt, delay);
+  KernelExit(sr);
+  return 1;
+}
+
+// ******** OS_Timer_Stop ************
+// Cancel a timer, its callback does not run again
+// Inputs:  timer started with OS_Timer_Start, or never started
+//          but filled with zeros (e.g. a global)
+// Outputs: 1 if it was active, 0 if it had expired or was stopped
+// Can be called from an ISR or from a timer callback
+int OS_Timer_Stop(timerType *timerPt){
+  int wasActive;
+  long sr = KernelEnter();
+  wasActive = timerPt->active;
+  if (wasActive) {
+    TimerRemove(timerPt);
+  }
+  KernelExit(sr);
+  return wasActive;
 }
 
 //****edge-triggered event************
-int32_t *edgeSemaphore;
+// each edge trigger watches one GPIO pin; its port's ISR signals
+// or sets flags, then masks the pin for the debounce time, which
+// the 1 ms tick counts down before it rearms the pin
+struct edge {
+  uint32_t port;             // 0 for Port A to 5 for Port F
+  uint32_t bit;              // pin mask, 1<<pin
+  uint32_t debounce;         // ms to ignore the pin after an edge
+  volatile uint32_t left;    // ms until the pin is rearmed, 0 if armed
+  semaType *semaPt;          // signaled on each edge, or NULL
+  flagsType *flagsPt;        // set on each edge, or NULL
+  uint32_t flags;
+  uint32_t count;            // edges taken
+};
+typedef struct edge edgeType;
+edgeType Edges[NUMEDGES];
+// GPIO Port A to F on the APB, and their IRQ numbers
+const uint32_t EdgePortBase[6] = {0x40004000, 0x40005000, 0x40006000,
+                                  0x40007000, 0x40024000, 0x40025000};
+const uint8_t EdgePortIRQ[6] = {0, 1, 2, 3, 4, 30};
+#define GPIOREG(port,offset) (*((volatile uint32_t *)(EdgePortBase[port]+(offset))))
+#define GPIO_DIR   0x400
+#define GPIO_IS    0x404
+#define GPIO_IBE   0x408
+#define GPIO_IEV   0x40C
+#define GPIO_IM    0x410
+#define GPIO_RIS   0x414
+#define GPIO_ICR   0x41C
+#define GPIO_AFSEL 0x420
+#define GPIO_PUR   0x510
+#define GPIO_PDR   0x514
+#define GPIO_DEN   0x51C
+#define GPIO_LOCK  0x520
+#define GPIO_CR    0x524
+#define GPIO_AMSEL 0x528
+#define GPIO_PCTL  0x52C
+
+// ******** OS_Edge_Init ************
+// Signal a semaphore and/or set event flags on an edge of any
+// GPIO pin on Port A to F, ignoring the bounces that follow
+// Inputs:  port, EDGE_PORTA to EDGE_PORTF
+//          pin, 0 to 7
+//          EDGE_FALLING, EDGE_RISING or EDGE_BOTH, plus
+//            EDGE_PULLUP or EDGE_PULLDOWN for an internal resistor
+//          debounce, ms to ignore the pin after an edge, 0 for none
+//          semaphore to signal, or NULL
+//          event flag group to set, or NULL, and the flags to set
+//          priority of the port's interrupt, KERNELCEILING to 7,
+//            shared by the pins of a port (the last call sets it)
+// Outputs: 1 if successful, 0 if bad arguments or too many triggers
+// PC0-PC3 are the JTAG/SWD pins and are refused
+int OS_Edge_Init(uint32_t port, uint32_t pin, uint32_t edge, uint32_t debounce,
+                 semaType *semaPt, flagsType *flagsPt, uint32_t flags, uint8_t priority){
+  edgeType *e;
+  uint32_t bit = 1<<pin;
+  long status;
+  if((port > EDGE_PORTF)||(pin > 7)||((edge&EDGE_BOTH) == 0)||
+     (priority < KERNELCEILING)||(priority > 7)||(NumEdges == NUMEDGES)||
+     ((port == EDGE_PORTC)&&(pin < 4))){   // the debugger needs them
+    return 0;
+  }
+  SYSCTL_RCGCGPIO_R |= 1<<port;    // 1) activate clock for the port
+  while((SYSCTL_PRGPIO_R&(1<<port)) == 0){};// allow time for clock to stabilize
+  status = KernelEnter();
+  e = &Edges[NumEdges];
+  NumEdges++;
+  e->port = port;
+  e->bit = bit;
+  e->debounce = debounce;
+  e->left = 0;
+  e->semaPt = semaPt;
+  e->flagsPt = flagsPt;
+  e->flags = flags;
+  e->count = 0;
+  if(((port == EDGE_PORTD)&&(pin == 7))||((port == EDGE_PORTF)&&(pin == 0))){
+    GPIOREG(port, GPIO_LOCK) = 0x4C4F434B; // 2) unlock PD7 or PF0
+    GPIOREG(port, GPIO_CR) |= bit;
+  }
+  GPIOREG(port, GPIO_AMSEL) &= ~bit;    // 3) disable analog
+  GPIOREG(port, GPIO_PCTL) &= ~(0xF<<(4*pin)); // 4) configure as GPIO
+  GPIOREG(port, GPIO_DIR) &= ~bit;      // 5) make input
+  GPIOREG(port, GPIO_AFSEL) &= ~bit;    // 6) disable alt funct
+  if(edge&EDGE_PULLUP){
+    GPIOREG(port, GPIO_PUR) |= bit;
+  } else{
+    GPIOREG(port, GPIO_PUR) &= ~bit;
+  }
+  if(edge&EDGE_PULLDOWN){
+    GPIOREG(port, GPIO_PDR) |= bit;
+  } else{
+    GPIOREG(port, GPIO_PDR) &= ~bit;
+  }
+  GPIOREG(port, GPIO_DEN) |= bit;       // 7) enable digital I/O
+  GPIOREG(port, GPIO_IS) &= ~bit;       // edge-sensitive
+  if((edge&EDGE_BOTH) == EDGE_BOTH){
+    GPIOREG(port, GPIO_IBE) |= bit;     // both edges
+  } else{
+    GPIOREG(port, GPIO_IBE) &= ~bit;
+    if(edge&EDGE_RISING){
+      GPIOREG(port, GPIO_IEV) |= bit;   // rising edge event
+    } else{
+      GPIOREG(port, GPIO_IEV) &= ~bit;  // falling edge event
+    }
+  }
+  GPIOREG(port, GPIO_ICR) = bit;        // clear flag
+  GPIOREG(port, GPIO_IM) |= bit;        // arm interrupt
+  ((volatile uint8_t *)&NVIC_PRI0_R)[EdgePortIRQ[port]] = priority<<5;
+  NVIC_EN0_R = 1<<EdgePortIRQ[port];
+  KernelExit(status);
+  return 1;
+}
+
+// ******** EdgeTick ************
+// Count down the debounce time of masked pins, called every 1 ms
+// Bounces seen while masked are cleared before the pin is rearmed
+// Inputs:  none
+// Outputs: none
+// Must be called with interrupts disabled
+void static EdgeTick(void){
+  uint32_t i;
+  edgeType *e;
+  for(i=0; i<NumEdges; i++){
+    e = &Edges[i];
+    if(e->left){
+      e->left--;
+      if(e->left == 0){
+        GPIOREG(e->port, GPIO_ICR) = e->bit;
+        GPIOREG(e->port, GPIO_IM) |= e->bit;
+        EdgeDebouncing--;
+      }
+    }
+  }
+}
+
+// ******** EdgeISR ************
+// Handle the pins of one port that have an edge
+// Inputs:  port, 0 for Port A to 5 for Port F
+// Outputs: none
+void static EdgeISR(uint32_t port){
+  uint32_t i,got;
+  edgeType *e;
+  long sr = KernelEnter();
+  got = GPIOREG(port, GPIO_RIS)&GPIOREG(port, GPIO_IM);
+  GPIOREG(port, GPIO_ICR) = got;        // acknowledge
+  for(i=0; i<NumEdges; i++){
+    e = &Edges[i];
+    if((e->port == port)&&(got&e->bit)){
+      e->count++;
+      if(e->debounce){                  // ignore the bounces
+        GPIOREG(port, GPIO_IM) &= ~e->bit;
+        e->left = e->debounce;
+        EdgeDebouncing++;
+      }
+      if(e->semaPt){
+        OS_Signal(e->semaPt);
+      }
+      if(e->flagsPt){
+        OS_SetFlags(e->flagsPt, e->flags);
+      }
+    }
+  }
+  KernelExit(sr);
+}
+
+void GPIOPortA_Handler(void){
+  TRACEPOINT(TRACE_ISRENTER, TRACEID(RunPt), 16);
+  EdgeISR(EDGE_PORTA);
+  TRACEPOINT(TRACE_ISREXIT, TRACEID(RunPt), 16);
+}
+void GPIOPortB_Handler(void){
+  TRACEPOINT(TRACE_ISRENTER, TRACEID(RunPt), 17);
+  EdgeISR(EDGE_PORTB);
+  TRACEPOINT(TRACE_ISREXIT, TRACEID(RunPt), 17);
+}
+void GPIOPortC_Handler(void){
+  TRACEPOINT(TRACE_ISRENTER, TRACEID(RunPt), 18);
+  EdgeISR(EDGE_PORTC);
+  TRACEPOINT(TRACE_ISREXIT, TRACEID(RunPt), 18);
+}
+void GPIOPortD_Handler(void){
+  TRACEPOINT(TRACE_ISRENTER, TRACEID(RunPt), 19);
+  EdgeISR(EDGE_PORTD);
+  TRACEPOINT(TRACE_ISREXIT, TRACEID(RunPt), 19);
+}
+void GPIOPortE_Handler(void){
+  TRACEPOINT(TRACE_ISRENTER, TRACEID(RunPt), 20);
+  EdgeISR(EDGE_PORTE);
+  TRACEPOINT(TRACE_ISREXIT, TRACEID(RunPt), 20);
+}
+void GPIOPortF_Handler(void){
+  TRACEPOINT(TRACE_ISRENTER, TRACEID(RunPt), 46);
+  EdgeISR(EDGE_PORTF);
+  TRACEPOINT(TRACE_ISREXIT, TRACEID(RunPt), 46);
+}
+
 // ******** OS_EdgeTrigger_Init ************
 // Initialize button1, PD6, to signal on a falling edge interrupt
 // Inputs:  semaphore to signal
 //          priority
 // Outputs: none
-void OS_EdgeTrigger_Init(int32_t *semaPt, uint8_t priority){
-	edgeSemaphore = semaPt;
-	SYSCTL_RCGCGPIO_R |= 0x00000008; // 1) activate clock for Port D
-  while((SYSCTL_PRGPIO_R&0x08) == 0){};// allow time for clock to stabilize
-                                   // 2) no need to unlock PD6
-  GPIO_PORTD_AMSEL_R &= ~0x40;     // 3) disable analog on PD6
-                                   // 4) configure PD6 as GPIO
-  GPIO_PORTD_PCTL_R = (GPIO_PORTD_PCTL_R&0xF0FFFFFF)+0x00000000;
-  GPIO_PORTD_DIR_R &= ~0x40;       // 5) make PD6 input
-  GPIO_PORTD_AFSEL_R &= ~0x40;     // 6) disable alt funct on PD6
-  GPIO_PORTD_PUR_R &= ~0x40;       // disable pull-up on PD6
-  GPIO_PORTD_DEN_R |= 0x40;        // 7) enable digital I/O on PD6
-
-  GPIO_PORTD_IS_R &= ~0x40;
-  GPIO_PORTD_IBE_R &= ~0x40;
-  GPIO_PORTD_IEV_R &= ~0x40;
-  GPIO_PORTD_ICR_R = 1 << 6;
-  GPIO_PORTD_IM_R |= 0x40;
-
-	NVIC_PRI0_R |= (priority << 29) | (NVIC_PRI0_R & 0x0FFFFFFF);
-  NVIC_EN0_R = 1 << 3;
-  // 1) activate clock for Port D
-  // 2) no need to unlock PD6
-  // 3) disable analog on PD6
-  // 4) configure PD6 as GPIO
-  // 5) make PD6 input
-  // 6) disable alt funct on PD6
-  // GPIO_PORTD_PCTL_R &= ~GPIO_PCTL_PD6_M;
-  // disable pull-up on PD6
-  // 7) enable digital I/O on PD6
-  // (d) PD6 is edge-sensitive
-  // PD6 is not both edges
-  // PD6 is falling edge event
-  // (e) clear PD6 flag
-  // GPIO_PORTD_CR_R
-  // (f) arm interrupt on PD6
-  // priority on Port D edge trigger is NVIC_PRI0_R	31 � 29
-  // enable is bit 3 in NVIC_EN0_R
-}
-
-// ******** OS_EdgeTrigger_Restart ************
-// restart button1 to signal on a falling edge interrupt
-// rearm interrupt
+void OS_EdgeTrigger_Init(semaType *semaPt, uint8_t priority){
+  OS_Edge_Init(EDGE_PORTD, 6, EDGE_FALLING, EDGEDEBOUNCE, semaPt, NULL, 0, priority);
+}
+
+#if SERVERS
+//****sporadic servers************
+// a served thread is charged for the bus cycles it runs while it
+// has budget left; Scheduler starts the charge when it switches the
+// thread in, and stops it when it switches the thread out or when
+// Wide Timer 1A, started with the budget left, runs out
+
+// ******** BudgetTimer_Init ************
+// Set up Wide Timer 1A as a one-shot down counter, started by
+// ServerStart and interrupting at priority KERNELCEILING
 // Inputs:  none
 // Outputs: none
-void OS_EdgeTrigger_Restart(void){
-//***IMPLEMENT THIS***
-// rearm interrupt 3 in NVIC
-  GPIO_PORTD_IM_R |= 0x40;
-  // clear flag6
-  GPIO_PORTD_ICR_R = 1 << 6;
+void static BudgetTimer_Init(void){
+  SYSCTL_RCGCWTIMER_R |= 0x02;     // activate clock for Wide Timer1
+  while((SYSCTL_PRWTIMER_R&0x02) == 0){};// allow time for clock to stabilize
+  WTIMER1_CTL_R &= ~TIMER_CTL_TAEN;// disable Wide Timer1A
+  WTIMER1_CFG_R = TIMER_CFG_16_BIT;// configure for 32-bit timer mode
+  WTIMER1_TAMR_R = TIMER_TAMR_TAMR_1_SHOT; // one-shot, down-count
+  WTIMER1_TAPR_R = 0;              // bus clock resolution
+  WTIMER1_ICR_R = TIMER_ICR_TATOCINT;// clear WTIMER1A timeout flag
+  WTIMER1_IMR_R |= TIMER_IMR_TATOIM;// arm timeout interrupt
+// vector number 112, interrupt number 96, bits 7:5 of PRI24
+  NVIC_PRI24_R = (NVIC_PRI24_R&0xFFFFFF00)|(KERNELCEILING<<5);
+  NVIC_EN3_R = 1<<0;               // enable IRQ 96 in NVIC
 }
 
-void GPIOPortD_Handler(void){
-//***IMPLEMENT THIS***
-	// step 1 acknowledge by clearing flag
-  if (GPIO_PORTD_RIS_R & ~0x40) {  // poll PD
-    GPIO_PORTD_ICR_R = 1 << 6;
-    // step 2 signal semaphore (no need to run scheduler)
-    OS_Signal(edgeSemaphore);
-    // step 3 disarm interrupt to prevent bouncing to create multiple signals
-    GPIO_PORTD_IM_R &= ~0x40;
+// ******** ServerPriority ************
+// Run a served thread at its high priority if it has budget left,
+// else at its low one, but not below a thread waiting on a mutex
+// it owns
+// Inputs:  served thread
+// Outputs: none
+// Must be called with interrupts disabled
+void static ServerPriority(tcbType *thread){
+  serverType *s = thread->server;
+  thread->basePriority = (s->left > 0) ? s->high : s->low;
+  Inherit(thread);
+  if(thread->mutexPt){               // keep the mutex's wait list sorted
+    MutexRemove(thread->mutexPt, thread);
+    MutexInsert(thread->mutexPt, thread);
+  }
+}
+
+// ******** ServerPost ************
+// The budget used since start comes back one period after start
+// Inputs:  server
+// Outputs: none
+// Must be called with interrupts disabled
+void static ServerPost(serverType *s){
+  uint32_t n = s->replCount;
+  if(s->used == 0){
+    return;
+  }
+  if(n == SERVER_REPLENISH){         // no room, join the last part
+    n--;                             // and come back later with it
+    s->replAmount[n] = s->replAmount[n]+s->used;
+  } else{
+    s->replAmount[n] = s->used;
+    s->replCount = n+1;
+  }
+  s->replTime[n] = s->start+s->period;
+  s->used = 0;
+}
+
+// ******** ServerStop ************
+// Charge the thread being switched out for the time it ran, and
+// end its use of the budget if it blocked or used it all up
+// Inputs:  RunPt
+// Outputs: none
+// Must be called with interrupts disabled
+void static ServerStop(tcbType *thread){
+  serverType *s = Charging;
+  uint32_t used;
+  if(s == NULL){
+    return;
+  }
+  used = DWTCYCCNT - ChargeStart;
+  WTIMER1_CTL_R &= ~TIMER_CTL_TAEN;  // stop the budget timer
+  WTIMER1_ICR_R = TIMER_ICR_TATOCINT;
+  NVIC_UNPEND3_R = 0x00000001;       // and a timeout already pending (IRQ 96)
+  Charging = NULL;
+  s->left = s->left - (int32_t)used;
+  s->used = s->used + used;
+  if(s->left <= 0){                  // out of budget
+    s->exhausted++;
+    ServerPost(s);
+    ServerPriority(thread);
+  } else if(thread->sleep || thread->semaPt || thread->mutexPt || thread->flagsPt){
+    ServerPost(s);                   // blocked, done for now
+  }
+}
+
+// ******** ServerStart ************
+// Start charging the thread being switched in, if it is served and
+// has budget left, and start the budget timer with what is left
+// Inputs:  thread about to run
+// Outputs: none
+// Must be called with interrupts disabled
+void static ServerStart(tcbType *thread){
+  serverType *s = thread->server;
+  if((s == NULL)||(s->left <= 0)){
+    return;
+  }
+  if(s->used == 0){
+    s->start = OSTime;               // a new use of the budget
+  }
+  Charging = s;
+  ChargeStart = DWTCYCCNT;
+  WTIMER1_TAILR_R = s->left-1;
+  WTIMER1_TAV_R = s->left-1;
+  WTIMER1_CTL_R |= TIMER_CTL_TAEN;
+}
+
+// ******** ServerTick ************
+// Give back the parts of budgets that are due, called every 1 ms
+// A thread that gets budget back runs at its high priority again
+// Inputs:  none
+// Outputs: none
+// Must be called with interrupts disabled
+void static ServerTick(void){
+  serverType *s;
+  uint32_t i;
+  int32_t wasLeft;
+  for(s = ServerList; s != NULL; s = s->next){
+    while(s->replCount && ((int32_t)(OSTime - s->replTime[0]) >= 0)){
+      wasLeft = s->left;
+      s->left = s->left+(int32_t)s->replAmount[0];
+      s->replCount--;
+      for(i=0; i<s->replCount; i++){
+        s->replTime[i] = s->replTime[i+1];
+        s->replAmount[i] = s->replAmount[i+1];
+      }
+      if((wasLeft <= 0)&&(s->left > 0)){
+        ServerPriority(s->thread);
+        INTCTRL = 0x10000000;        // trigger PendSV, it may run now
+      } else if(s == Charging){
+        INTCTRL = 0x10000000;        // restart the timer with the new budget
+      }
+    }
   }
 }
+
+// Wide Timer 1A runs out when the running served thread has used
+// its budget; Scheduler then picks the next thread. A timeout that
+// ServerStop already handled, in a switch after the timer ran out,
+// leaves nothing to do.
+void WideTimer1A_Handler(void){
+  long sr = KernelEnter();
+  if(((WTIMER1_RIS_R&TIMER_RIS_TATORIS) == 0)||(Charging == NULL)){
+    KernelExit(sr);
+    return;
+  }
+  TRACEPOINT(TRACE_ISRENTER, TRACEID(RunPt), 112);
+  WTIMER1_ICR_R = TIMER_ICR_TATOCINT;// acknowledge Wide Timer1A timeout
+  ServerStop(RunPt);
+  INTCTRL = 0x10000000;              // trigger PendSV
+  TRACEPOINT(TRACE_ISREXIT, TRACEID(RunPt), 112);
+  KernelExit(sr);
+}
+
+// ******** OS_Server_Init ************
+// Run the calling thread under a sporadic server
+// Inputs:  server, owned by the caller
+//          budget in us, less than period
+//          period in ms
+//          low priority, lower than the thread's (larger number)
+// Outputs: 1 if successful, 0 if bad arguments or the thread
+//          has a deadline
+int OS_Server_Init(serverType *serverPt, uint32_t budget, uint32_t period, uint32_t low){
+  long sr;
+  if((budget == 0)||(period == 0)||(budget >= period*1000)||
+     (low >= NUMPRIORITY)||(low <= RunPt->basePriority)||
+     RunPt->relDeadline||RunPt->server){
+    return 0;
+  }
+  sr = KernelEnter();
+  serverPt->thread = RunPt;
+  serverPt->budget = budget*(BSP_Clock_GetFreq()/1000000);
+  serverPt->period = period;
+  serverPt->high = RunPt->basePriority;
+  serverPt->low = low;
+  serverPt->left = (int32_t)serverPt->budget;
+  serverPt->used = 0;
+  serverPt->replCount = 0;
+  serverPt->exhausted = 0;
+  serverPt->next = ServerList;
+  ServerList = serverPt;
+  RunPt->server = serverPt;
+  INTCTRL = 0x10000000;              // trigger PendSV, it starts the charge
+  KernelExit(sr);
+  return 1;
+}
+#endif
+
+//****microsecond time base************
+// Wide Timer 2 is one 64-bit timer counting bus cycles up from 0
+// since OS_Init; its match interrupt wakes up the threads in
+// OS_SleepUntil, which are sorted by wake up time
+
+// ******** TimeBase_Init ************
+// Start Wide Timer 2 as a free-running 64-bit up counter, with the
+// match interrupt at priority KERNELCEILING
+// Inputs:  none
+// Outputs: none
+void static TimeBase_Init(void){
+  CyclesPerUs = BSP_Clock_GetFreq()/1000000;
+  SYSCTL_RCGCWTIMER_R |= 0x04;     // activate clock for Wide Timer2
+  while((SYSCTL_PRWTIMER_R&0x04) == 0){};// allow time for clock to stabilize
+  WTIMER2_CTL_R &= ~TIMER_CTL_TAEN;// disable Wide Timer2 during setup
+  WTIMER2_CFG_R = TIMER_CFG_32_BIT_TIMER; // one 64-bit timer
+                                   // periodic, count up, match interrupt
+  WTIMER2_TAMR_R = TIMER_TAMR_TAMR_PERIOD|TIMER_TAMR_TACDIR|TIMER_TAMR_TAMIE;
+  WTIMER2_TAILR_R = 0xFFFFFFFF;    // counts to 2^64-1, thousands of years
+  WTIMER2_TBILR_R = 0xFFFFFFFF;
+  WTIMER2_TAMATCHR_R = 0xFFFFFFFF; // no match until a thread sleeps
+  WTIMER2_TBMATCHR_R = 0xFFFFFFFF;
+  WTIMER2_ICR_R = TIMER_ICR_TAMCINT;// clear WTIMER2A match flag
+  WTIMER2_IMR_R |= TIMER_IMR_TAMIM;// arm match interrupt
+// vector number 114, interrupt number 98, bits 23:21 of PRI24
+  NVIC_PRI24_R = (NVIC_PRI24_R&0xFF1FFFFF)|(KERNELCEILING<<21);
+  NVIC_EN3_R = 1<<2;               // enable IRQ 98 in NVIC
+  WTIMER2_CTL_R |= TIMER_CTL_TAEN; // enable Wide Timer2 64-b
+}
+
+// ******** TimeCycles ************
+// Read the 64-bit time base
+// The high half is read again in case the low half wrapped
+// Inputs:  none
+// Outputs: bus cycles since OS_Init
+uint64_t static TimeCycles(void){
+  uint32_t high,low;
+  do{
+    high = WTIMER2_TBV_R;
+    low = WTIMER2_TAV_R;
+  } while(high != WTIMER2_TBV_R);
+  return ((uint64_t)high<<32)|low;
+}
+
+// ******** OS_TimeUs ************
+// Microseconds since OS_Init
+// Inputs:  none
+// Outputs: time in us
+uint64_t OS_TimeUs(void){
+  return TimeCycles()/CyclesPerUs;
+}
+
+// ******** MatchArm ************
+// Set the match for the first OS_SleepUntil thread, and wake up
+// the ones that are due or too close for the match to catch
+// Inputs:  none
+// Outputs: none
+// Must be called with interrupts disabled
+void static MatchArm(void){
+  tcbType *cur;
+  while(UsSleepPt){
+    WTIMER2_TBMATCHR_R = (uint32_t)(UsSleepPt->wake>>32);
+    WTIMER2_TAMATCHR_R = (uint32_t)UsSleepPt->wake;
+    if((int64_t)(UsSleepPt->wake - TimeCycles()) > MATCHMARGIN){
+      return;                        // the match interrupt will come
+    }
+    cur = UsSleepPt;                 // done sleeping
+    UsSleepPt = cur->nextSleep;
+    cur->sleep = 0;
+    ReadyAdd(cur);
+    if(Beats(cur, RunPt)){
+      INTCTRL = 0x10000000;          // trigger PendSV
+    }
+  }
+}
+
+// Wide Timer 2 matched the wake up time of the first
+// OS_SleepUntil thread
+void WideTimer2A_Handler(void){
+  long sr = KernelEnter();
+  TRACEPOINT(TRACE_ISRENTER, TRACEID(RunPt), 114);
+  WTIMER2_ICR_R = TIMER_ICR_TAMCINT;// acknowledge Wide Timer2A match
+  MatchArm();
+  TRACEPOINT(TRACE_ISREXIT, TRACEID(RunPt), 114);
+  KernelExit(sr);
+}
+
+// ******** SleepUntil ************
+// Put the running thread in the OS_SleepUntil list
+// Inputs:  time base value, in bus cycles, to wake up at
+// Outputs: none
+void static SleepUntil(uint64_t wake){
+  tcbType **pt;
+  uint64_t left;
+  long sr = KernelEnter();
+  left = wake - TimeCycles();
+  if((int64_t)left <= MATCHMARGIN){
+    KernelExit(sr);
+    return;                          // already there
+  }
+  left = left/CyclesPerUs/1000;      // ms, for the trace
+  TRACEPOINT(TRACE_SLEEP, TRACEID(RunPt), (left > 0xFFFF) ? 0xFFFF : left);
+  RunPt->wake = wake;
+  RunPt->sleep = 1;                  // not ready, see SetPriority
+  ReadyRemove(RunPt);
+  pt = &UsSleepPt;
+  while(*pt && ((int64_t)((*pt)->wake - wake) <= 0)){
+    pt = &(*pt)->nextSleep;          // equal times wake up in FIFO order
+  }
+  RunPt->nextSleep = *pt;
+  *pt = RunPt;
+  if(UsSleepPt == RunPt){
+    MatchArm();                      // new first thread to wake up
+  }
+  KernelExit(sr);
+  OS_Suspend();
+}
+
+// ******** OS_SleepUntil ************
+// Sleep until OS_TimeUs reaches a time
+// Inputs:  time in us, returns at once if it has already passed
+// Outputs: none
+void OS_SleepUntil(uint64_t time){
+  SleepUntil(time*CyclesPerUs);
+}
+
+// ******** OS_SleepUs ************
+// Sleep for a number of us
+// Inputs:  time in us
+// Outputs: none
+void OS_SleepUs(uint32_t time){
+  SleepUntil(TimeCycles()+(uint64_t)time*CyclesPerUs);
+}
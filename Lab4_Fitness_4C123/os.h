@@ -29,6 +29,12 @@
 #define __OS_H  1
 #define NULL 0
 
+// The kernel protects its data by raising BASEPRI, not by setting
+// PRIMASK, so interrupts at NVIC priority 0 are never delayed by a
+// thread switch or an OS call (KERNELCEILING in os.c, default 1).
+// An ISR at priority 0 must not call any OS_ function; the one
+// exception is OS_Ring_Put on a ring without a wake semaphore.
+
 // ******** OS_Init ************
 // Initialize operating system, disable interrupts
 // Initialize OS controlled I/O: periodic interrupt, bus clock as fast as possible
@@ -37,10 +43,19 @@
 // Outputs: none
 void OS_Init(void);
 
+//******** OS_AddThread ***************
+// Add one main thread to the scheduler, with a stack of its own size
+// taken from the stack pool. Can be called before or after OS_Launch.
+// Inputs: function pointer to a void/void main thread
+//         priority (0 highest, 31 lowest)
+//         number of 32-bit words in its stack, at least 32
+// Outputs: 1 if successful, 0 if this thread can not be added
+int OS_AddThread(void(*task)(void), uint32_t priority, uint32_t stackWords);
+
 //******** OS_AddThreads ***************
-// Add eight main threads to the scheduler
+// Add eight main threads to the scheduler, each with 100 words of stack
 // Inputs: function pointers to eight void/void main threads
-//         priorites for each main thread (0 highest)
+//         priorites for each main thread (0 highest, 31 lowest)
 // Outputs: 1 if successful, 0 if this thread can not be added
 // This function will only be called once, after OS_Init and before OS_Launch
 int OS_AddThreads(void(*thread0)(void), uint32_t p0,
@@ -52,10 +67,51 @@ int OS_AddThreads(void(*thread0)(void), uint32_t p0,
                   void(*thread6)(void), uint32_t p6,
                   void(*thread7)(void), uint32_t p7);
 
+//******** OS_StackUsage ***************
+// Deepest the stack of a thread has ever grown
+// Inputs: thread number, 0 for the first thread added
+// Outputs: number of 32-bit words used, including the initial
+//          register frame, -1 if there is no such thread, or
+//          -2 if it overflowed and wrote over the canary
+// The kernel also checks a canary at the bottom of each stack on
+// every context switch, and stops if a thread has overflowed
+int32_t OS_StackUsage(uint32_t thread);
+
+// processor time used by one thread, see OS_GetThreadStats
+struct threadStats {
+  uint64_t runCycles;        // bus cycles the thread has run
+  uint32_t switches;         // number of times it was switched in
+  uint32_t utilization;      // share of the time since OS_Init, in 0.1%
+};
+typedef struct threadStats threadStatsType;
+
+//******** OS_GetThreadStats ***************
+// Processor time used by a thread, measured at every context switch
+// Inputs: thread number, 0 for the first thread added
+//         place to store the statistics
+// Outputs: 1 if successful, 0 if there is no such thread
+int OS_GetThreadStats(uint32_t thread, threadStatsType *stats);
+
+//******** OS_CPULoad ***************
+// Fraction of the time the processor was not idle, over the last
+// complete one second window; the kernel's idle thread runs WFI
+// and counts the cycles it sleeps, so no user thread has to
+// Inputs: none
+// Outputs: load in 0.1% units, 0 to 1000, 0 for the first window
+uint32_t OS_CPULoad(void);
+
+//******** OS_Trace ***************
+// Record an event in the kernel trace, so user ISRs and
+// threads show up in the timeline next to the kernel events
+// Inputs: event code from trace.h, e.g. TRACE_ISRENTER
+//         argument, e.g. the vector number
+// Outputs: none
+void OS_Trace(uint8_t event, uint16_t arg);
 
 //******** OS_Launch ***************
 // Start the scheduler, enable interrupts
-// Inputs: number of clock cycles for each time slice
+// Inputs: number of clock cycles for each time slice; threads at
+//         the same priority take turns of OS_SetQuantum slices
 // Outputs: none (does not return)
 // Errors: theTimeSlice must be less than 16,777,216
 void OS_Launch(uint32_t theTimeSlice);
@@ -74,12 +130,74 @@ void OS_Suspend(void);
 // OS_Sleep(0) implements cooperative multitasking
 void OS_Sleep(uint32_t sleepTime);
 
+// ******** OS_TimeUs ************
+// Microseconds since OS_Init, from a 64-bit free-running wide
+// timer (Wide Timer 2) counting bus cycles, so it never wraps
+// Inputs:  none
+// Outputs: time in us
+// Can be called from any thread or ISR
+uint64_t OS_TimeUs(void);
+
+// ******** OS_SleepUntil ************
+// Sleep until OS_TimeUs reaches a time, e.g. next = next+250 then
+// OS_SleepUntil(next) runs a loop every 250 us with no drift
+// The thread is made ready by a Wide Timer 2 match interrupt at
+// priority 1, so it wakes up within about 1 us of the time
+// Inputs:  time in us, returns at once if it has already passed
+// Outputs: none
+void OS_SleepUntil(uint64_t time);
+
+// ******** OS_SleepUs ************
+// Sleep for a number of us, at the resolution of OS_SleepUntil
+// Inputs:  time in us
+// Outputs: none
+void OS_SleepUs(uint32_t time);
+
+struct tcb;                  // thread control block, private to os.c
+// counting semaphore
+// threads blocked on a semaphore wait in a FIFO list,
+// linked through their TCBs, so signal and wait are O(1)
+struct sema {
+  int32_t value;             // negative means -value threads are blocked
+  struct tcb *head;          // blocked the longest, next to wake up
+  struct tcb *tail;          // blocked most recently
+};
+typedef struct sema semaType;
+
+// ******** OS_SetQuantum ************
+// Set how many time slices in a row the calling thread may run
+// before the next ready thread at the same priority gets a turn
+// (1 for a new thread). A thread that is preempted by a higher
+// priority one keeps the rest of its turn; one that blocks or
+// sleeps gets a full turn when it is ready again.
+// Inputs:  time slices per turn, 0 to run until it blocks, sleeps
+//          or calls OS_Suspend
+// Outputs: none
+void OS_SetQuantum(uint32_t slices);
+
+// ******** OS_SetDeadline ************
+// Give the calling thread a relative deadline for EDF scheduling
+// A job is released each time the thread becomes ready, due that
+// many ms later, and ends when the thread blocks or sleeps;
+// waiting for a mutex does not end it.
+// Threads with a deadline run before threads without one.
+// Inputs:  relative deadline in ms, 0 to go back to fixed priority
+// Outputs: none
+// Has no effect unless EDF is 1 in os.c
+void OS_SetDeadline(uint32_t deadline);
+
+// ******** OS_DeadlineMisses ************
+// Number of EDF jobs that finished after their deadline
+// Inputs:  none
+// Outputs: total number of deadline misses since OS_Init
+uint32_t OS_DeadlineMisses(void);
+
 // ******** OS_InitSemaphore ************
 // Initialize counting semaphore
 // Inputs:  pointer to a semaphore
 //          initial value of semaphore
 // Outputs: none
-void OS_InitSemaphore(int32_t *semaPt, int32_t value);
+void OS_InitSemaphore(semaType *semaPt, int32_t value);
 
 // ******** OS_Wait ************
 // Decrement semaphore and block if less than zero
@@ -87,7 +205,23 @@ void OS_InitSemaphore(int32_t *semaPt, int32_t value);
 // Lab3 block if less than zero
 // Inputs:  pointer to a counting semaphore
 // Outputs: none
-void OS_Wait(int32_t *semaPt);
+void OS_Wait(semaType *semaPt);
+
+// ******** OS_WaitTimeout ************
+// Decrement semaphore, blocking for at most timeout ms if
+// less than zero; whichever comes first, OS_Signal or the
+// timeout, makes the thread ready again
+// Inputs:  pointer to a counting semaphore
+//          number of msec to wait, 0 to never block (OS_TryWait)
+// Outputs: 1 if the semaphore was taken, 0 if the time ran out
+int OS_WaitTimeout(semaType *semaPt, uint32_t timeout);
+
+// ******** OS_TryWait ************
+// Decrement a semaphore only if that does not block
+// Inputs:  pointer to a counting semaphore
+// Outputs: 1 if decremented, 0 if it was not positive
+// Can be called from an ISR
+int OS_TryWait(semaType *semaPt);
 
 // ******** OS_Signal ************
 // Increment semaphore
@@ -95,7 +229,224 @@ void OS_Wait(int32_t *semaPt);
 // Lab3 wakeup blocked thread if appropriate
 // Inputs:  pointer to a counting semaphore
 // Outputs: none
-void OS_Signal(int32_t *semaPt);
+void OS_Signal(semaType *semaPt);
+
+// a mutex is owned by the thread that locked it; while a higher
+// priority thread is blocked on it, the owner runs at that priority
+// (priority inheritance), so a medium priority thread can not
+// stretch the time the high priority thread waits
+struct mutex {
+  struct tcb *owner;         // NULL if free
+  struct tcb *head;          // blocked threads, highest priority first
+  struct mutex *nextHeld;    // next mutex locked by the same owner
+};
+typedef struct mutex mutexType;
+
+// ******** OS_InitMutex ************
+// Initialize mutex as free
+// Inputs:  pointer to a mutex
+// Outputs: none
+void OS_InitMutex(mutexType *mutexPt);
+
+// ******** OS_Lock ************
+// Take ownership of the mutex, block if another thread owns it
+// The owner inherits the priority of the thread that blocks,
+// or in EDF mode its deadline if it has one
+// Inputs:  pointer to a mutex
+// Outputs: none
+// A thread must not lock a mutex it already owns
+void OS_Lock(mutexType *mutexPt);
+
+// ******** OS_Unlock ************
+// Give up ownership of the mutex, the blocked thread that
+// would run first becomes the owner
+// Inputs:  pointer to a mutex owned by this thread
+// Outputs: none
+void OS_Unlock(mutexType *mutexPt);
+
+// event flag group: up to 32 flags that ISRs and threads set,
+// a thread can block until any or all of a set of them are set,
+// so one thread can serve several event sources
+struct flags {
+  uint32_t value;            // bit n set means flag n is set
+  struct tcb *head;          // blocked threads, in the order they waited
+  struct tcb *tail;
+};
+typedef struct flags flagsType;
+#define FLAGS_ANY 0          // OS_WaitFlags mode: one flag in the mask is enough
+#define FLAGS_ALL 1          // OS_WaitFlags mode: every flag in the mask
+
+// ******** OS_InitFlags ************
+// Initialize an event flag group
+// Inputs:  pointer to a flag group
+//          flags initially set
+// Outputs: none
+void OS_InitFlags(flagsType *flagsPt, uint32_t value);
+
+// ******** OS_WaitFlags ************
+// Block until any or all of a set of flags are set
+// Inputs:  pointer to a flag group
+//          flags to wait for, not 0
+//          FLAGS_ANY or FLAGS_ALL
+//          nonzero to clear the flags that ended the wait
+// Outputs: the flags in the mask that were set
+uint32_t OS_WaitFlags(flagsType *flagsPt, uint32_t mask, uint32_t mode, int clear);
+
+// ******** OS_SetFlags ************
+// Set flags in a group and wake up the threads they satisfy,
+// in the order they started waiting. A thread that waits with
+// clear takes its flags, so threads after it may not see them.
+// Can be called from an ISR
+// Inputs:  pointer to a flag group
+//          flags to set
+// Outputs: none
+void OS_SetFlags(flagsType *flagsPt, uint32_t flags);
+
+// ******** OS_ClearFlags ************
+// Clear flags in a group, no thread wakes up
+// Inputs:  pointer to a flag group
+//          flags to clear
+// Outputs: none
+void OS_ClearFlags(flagsType *flagsPt, uint32_t flags);
+
+// message queue of fixed size elements, in storage given by the
+// caller, so each producer/consumer pair gets a queue of its own
+// with the element size and depth it needs
+struct queue {
+  uint8_t *buffer;           // depth elements of size bytes
+  uint32_t size;             // bytes in one element
+  uint32_t depth;            // maximum number of elements
+  uint32_t putI;             // element to fill next
+  uint32_t getI;             // element to empty next
+  uint32_t lost;             // elements a full queue turned away
+  semaType items;            // elements in the queue, getters wait on it
+  semaType spaces;           // free elements, putters wait on it
+};
+typedef struct queue queueType;
+
+// ******** OS_Queue_Init ************
+// Initialize an empty queue in storage given by the caller
+// Inputs:  pointer to a queue
+//          storage for depth elements of size bytes each
+//          size of one element in bytes
+//          maximum number of elements
+// Outputs: none
+void OS_Queue_Init(queueType *queuePt, void *buffer, uint32_t size, uint32_t depth);
+
+// ******** OS_Queue_Put ************
+// Copy one element into a queue
+// Inputs:  pointer to a queue
+//          element to copy, size bytes
+//          nonzero to wait for room, 0 to return at once
+// Outputs: 1 if stored, 0 if the queue was full (counted in lost)
+// Can be called from an ISR with block 0
+int OS_Queue_Put(queueType *queuePt, const void *data, int block);
+
+// ******** OS_Queue_Get ************
+// Copy the oldest element out of a queue
+// Inputs:  pointer to a queue
+//          place for the element, size bytes
+//          nonzero to wait for data, 0 to return at once
+// Outputs: 1 if an element was copied, 0 if the queue was empty
+// Can be called from an ISR with block 0
+int OS_Queue_Get(queueType *queuePt, void *data, int block);
+
+// ******** OS_Queue_PutBatch ************
+// Copy several elements into a queue, in order
+// Inputs:  pointer to a queue
+//          array of n elements
+//          number of elements
+//          nonzero to wait until all n are stored, 0 to store
+//          as many as fit now
+// Outputs: number of elements stored
+// With block 0 the elements that did not fit are counted in lost
+uint32_t OS_Queue_PutBatch(queueType *queuePt, const void *data, uint32_t n, int block);
+
+// ******** OS_Queue_GetBatch ************
+// Copy several elements out of a queue, oldest first
+// Inputs:  pointer to a queue
+//          place for n elements
+//          number of elements
+//          nonzero to wait until n are copied, 0 to copy
+//          the ones there now
+// Outputs: number of elements copied
+uint32_t OS_Queue_GetBatch(queueType *queuePt, void *data, uint32_t n, int block);
+
+// ******** OS_Queue_Count ************
+// Number of elements in a queue
+// Inputs:  pointer to a queue
+// Outputs: elements waiting to be read
+uint32_t OS_Queue_Count(queueType *queuePt);
+
+// ring buffer for one producer, often an ISR, and one consumer
+// thread; the two sides only write their own index, so putting
+// and getting never disable interrupts
+struct ring {
+  volatile uint8_t *buffer;  // depth elements of size bytes
+  uint32_t size;             // bytes in one element
+  uint32_t mask;             // depth-1, depth is a power of 2
+  volatile uint32_t putI;    // elements ever put, written by the producer
+  volatile uint32_t getI;    // elements ever taken, written by the consumer
+  volatile uint32_t waiting; // 1 while the consumer is blocked on wake
+  uint32_t lost;             // elements a full ring turned away
+  semaType *wake;            // signaled when the consumer must wake up
+};
+typedef struct ring ringType;
+
+// ******** OS_Ring_Init ************
+// Initialize an empty single producer, single consumer ring
+// Inputs:  pointer to a ring
+//          storage for depth elements of size bytes each
+//          size of one element in bytes
+//          maximum number of elements, a power of 2
+//          semaphore to wake up a blocked consumer, NULL if the
+//          consumer only polls; initialized here
+// Outputs: 1 if successful, 0 if depth is not a power of 2
+int OS_Ring_Init(ringType *ringPt, void *buffer, uint32_t size, uint32_t depth, semaType *wake);
+
+// ******** OS_Ring_Put ************
+// Copy one element into a ring, never waits and leaves
+// interrupts enabled; signals the wake semaphore only if the
+// consumer is blocked
+// Inputs:  pointer to a ring
+//          element to copy, size bytes
+// Outputs: 1 if stored, 0 if the ring was full (counted in lost)
+// Only one thread or ISR may put into a ring; a priority 0 ISR
+// may only put into a ring without a wake semaphore
+int OS_Ring_Put(ringType *ringPt, const void *data);
+
+// ******** OS_Ring_Get ************
+// Copy the oldest element out of a ring
+// Inputs:  pointer to a ring
+//          place for the element, size bytes
+//          nonzero to block until there is one (needs a wake
+//          semaphore), 0 to return at once
+// Outputs: 1 if an element was copied, 0 if the ring was empty
+// Only one thread may get from a ring
+int OS_Ring_Get(ringType *ringPt, void *data, int block);
+
+// ******** OS_Ring_Count ************
+// Number of elements in a ring
+// Inputs:  pointer to a ring
+// Outputs: elements waiting to be read
+uint32_t OS_Ring_Count(ringType *ringPt);
+
+// ******** OS_Defer ************
+// Post a job for the kernel's work queue thread to run, so an ISR
+// can leave its slow part (parsing, display, ...) to a thread;
+// jobs run one after another in the order they were posted, at
+// priority 1 (DEFERPRIORITY in os.c), with interrupts enabled.
+// At priority 1 a 1 ms thread at priority 0 never waits for a
+// job, but jobs wait for it and take turns with the threads at
+// priority 1. Build with DEFERPRIORITY=0 to run jobs sooner, at
+// the cost of the priority 0 threads sharing time slices with them.
+// Inputs:  function to run, it must not block for long since
+//            the jobs after it wait
+//          argument to pass to it
+// Outputs: 1 if posted, 0 if the queue was full
+// Can be called from any thread, or an ISR below KERNELCEILING
+// (NVIC priority 1 or lower), never waits
+int OS_Defer(void(*function)(uint32_t), uint32_t arg);
 
 // ******** OS_FIFO_Init ************
 // Initialize FIFO.  The "put" and "get" indices initially
@@ -126,34 +477,152 @@ int OS_FIFO_Put(uint32_t data);
 // Outputs: data retrieved
 uint32_t OS_FIFO_Get(void);
 
-// ******** OS_PeriodTrigger0_Init ************
-// Initialize periodic timer interrupt to signal 
+// ******** OS_PeriodTrigger_Init ************
+// Signal a semaphore periodically, from a 1 ms software interrupt
+// at priority 1 (KERNELCEILING in os.c) shared by all periodic
+// triggers; the 1 ms timer interrupt itself runs at priority 0
 // Inputs:  semaphore to signal
-//          period in ms
-// priority level at 0 (highest)
-// Outputs: none
-void OS_PeriodTrigger0_Init(int32_t *semaPt, uint32_t period);
+//          period in ms, greater than zero
+//          phase, ms until the first signal, 0 for one period
+// Outputs: 1 if successful, 0 if there are too many triggers
+// Give triggers different phases so they are not due on the same tick
+int OS_PeriodTrigger_Init(semaType *semaPt, uint32_t period, uint32_t phase);
 
-// ******** OS_PeriodTrigger1_Init ************
-// Initialize periodic timer interrupt to signal 
-// Inputs:  semaphore to signal
-//          period in ms
-// priority level at 0 (highest)
+// ******** OS_PeriodFlags_Init ************
+// Set event flags periodically, from the same 1 ms timer
+// interrupt as OS_PeriodTrigger_Init
+// Inputs:  flag group
+//          flags to set
+//          period in ms, greater than zero
+//          phase, ms until the first time, 0 for one period
+// Outputs: 1 if successful, 0 if there are too many triggers
+int OS_PeriodFlags_Init(flagsType *flagsPt, uint32_t flags, uint32_t period, uint32_t phase);
+
+// ******** OS_Sampler_Init ************
+// Run a function every 1 ms from the priority 0 timer interrupt
+// of the periodic triggers, before the triggers due on the same
+// tick are signaled. The kernel never delays it, so it samples at
+// the same point of every ms; a thread woken by a 1 ms trigger can
+// take the sample from a ring.
+// Inputs:  function to run, NULL to stop
 // Outputs: none
-void OS_PeriodTrigger1_Init(int32_t *semaPt, uint32_t period);
+// The function must not call any OS_ function except OS_Ring_Put
+// on a ring without a wake semaphore
+void OS_Sampler_Init(void(*sampler)(void));
+
+// software timer: calls a function after a delay, once or
+// periodically; all timers share the kernel's 1 ms tick
+struct timer {
+  void (*callback)(void);    // runs in the 1 ms timer ISR
+  uint32_t period;           // ms between calls, 0 for one-shot
+  uint32_t delta;            // ms after the timer before it
+  uint32_t count;            // calls since OS_Timer_Start
+  struct timer *next;        // next active timer to expire
+  uint32_t active;           // 1 while in the list of active timers
+};
+typedef struct timer timerType;
+
+// ******** OS_Timer_Start ************
+// Run a function once after delay ms, and then every period ms
+// if period is not zero; restarts the timer if it is active
+// Inputs:  timer, owned by the caller
+//          function to call, it runs in the 1 ms timer ISR so it
+//            must be short and must not block
+//          delay in ms until the first call, 0 for one period
+//          period in ms, 0 for a one-shot timer
+// Outputs: 1 if successful, 0 if both delay and period are 0
+// Can be called from an ISR or from a timer callback
+int OS_Timer_Start(timerType *timerPt, void(*callback)(void), uint32_t delay, uint32_t period);
+
+// ******** OS_Timer_Stop ************
+// Cancel a timer, its callback does not run again
+// Inputs:  timer started with OS_Timer_Start, or never started
+//          but filled with zeros (e.g. a global)
+// Outputs: 1 if it was active, 0 if it had expired or was stopped
+// Can be called from an ISR or from a timer callback
+int OS_Timer_Stop(timerType *timerPt);
+
+// edge triggers: an edge on a GPIO pin signals a semaphore and/or
+// sets event flags; the pin is then ignored for its debounce time,
+// and the kernel's 1 ms tick rearms it, so no thread has to
+#define EDGE_PORTA    0
+#define EDGE_PORTB    1
+#define EDGE_PORTC    2
+#define EDGE_PORTD    3
+#define EDGE_PORTE    4
+#define EDGE_PORTF    5
+#define EDGE_FALLING  0x01
+#define EDGE_RISING   0x02
+#define EDGE_BOTH     0x03
+#define EDGE_PULLUP   0x10   // enable the internal pull-up resistor
+#define EDGE_PULLDOWN 0x20   // enable the internal pull-down resistor
+
+// ******** OS_Edge_Init ************
+// Signal a semaphore and/or set event flags on an edge of any
+// GPIO pin on Port A to F, ignoring the bounces that follow
+// Inputs:  port, EDGE_PORTA to EDGE_PORTF
+//          pin, 0 to 7
+//          EDGE_FALLING, EDGE_RISING or EDGE_BOTH, plus
+//            EDGE_PULLUP or EDGE_PULLDOWN for an internal resistor
+//          debounce, ms to ignore the pin after an edge, 0 for none
+//          semaphore to signal, or NULL
+//          event flag group to set, or NULL, and the flags to set
+//          priority of the port's interrupt, 1 to 7, shared by the
+//            pins of a port (the last call sets it)
+// Outputs: 1 if successful, 0 if bad arguments or too many triggers
+// PC0-PC3 are refused, they are the JTAG/SWD debug pins
+// e.g. button1 (J4.33, PD6), falling edge, 20 ms debounce:
+//   OS_Edge_Init(EDGE_PORTD, 6, EDGE_FALLING, 20, &Touch, NULL, 0, 3);
+// OPT3001 interrupt (J1.8, PA5) and TMP006 data ready (J2.11, PA2)
+// are active low, falling edge, with no debounce
+int OS_Edge_Init(uint32_t port, uint32_t pin, uint32_t edge, uint32_t debounce,
+                 semaType *semaPt, flagsType *flagsPt, uint32_t flags, uint8_t priority);
 
 // ******** OS_EdgeTrigger_Init ************
-// Initialize button1, PD6, to signal on a falling edge interrupt
+// Initialize button1, PD6, to signal on a falling edge interrupt,
+// ignoring bounces for 20 ms; same as OS_Edge_Init above
 // Inputs:  semaphore to signal
-//          priority
+//          priority, 1 to 7 since the ISR signals
 // Outputs: none
-void OS_EdgeTrigger_Init(int32_t *semaPt, uint8_t priority);
+void OS_EdgeTrigger_Init(semaType *semaPt, uint8_t priority);
 
-// ******** OS_EdgeTrigger_Restart ************
-// restart button1 to signal on a falling edge interrupt
-// rearm interrupt
-// Inputs:  none
-// Outputs: none
-void OS_EdgeTrigger_Restart(void);
+// sporadic server: caps the processor time of a thread that handles
+// aperiodic work (button touches, BLE requests, redraws) at budget
+// in any period, while it still runs at a high priority for a short
+// response time. Once the budget is used up the thread drops to a
+// low priority, and each part of the budget comes back one period
+// after it started being used, so for the threads it may preempt the
+// server looks like a periodic thread that runs budget every period.
+#define SERVER_REPLENISH 4   // parts of a budget that can be on the way back
+struct server {
+  struct tcb *thread;        // thread that called OS_Server_Init
+  uint32_t budget;           // bus cycles per period
+  uint32_t period;           // ms
+  uint32_t high;             // priority while budget is left
+  uint32_t low;              // priority once it is used up
+  int32_t left;              // bus cycles of budget left
+  uint32_t start;            // ms (OSTime) when the budget in use started
+  uint32_t used;             // bus cycles used since then
+  uint32_t replTime[SERVER_REPLENISH];   // ms when each part comes back,
+  uint32_t replAmount[SERVER_REPLENISH]; // oldest first, and bus cycles
+  uint32_t replCount;
+  uint32_t exhausted;        // times the budget ran out
+  struct server *next;
+};
+typedef struct server serverType;
+
+// ******** OS_Server_Init ************
+// Run the calling thread under a sporadic server: at its priority
+// for at most budget us in any period ms, and at the low priority
+// for the rest; a Wide Timer 1A interrupt at priority 1 stops it
+// the moment the budget is used up
+// Inputs:  server, owned by the caller
+//          budget in us, less than period
+//          period in ms
+//          low priority, lower than the thread's (larger number)
+// Outputs: 1 if successful, 0 if bad arguments or the thread
+//          has a deadline (OS_SetDeadline)
+// Call once, from the thread to be served
+int OS_Server_Init(serverType *serverPt, uint32_t budget, uint32_t period, uint32_t low);
 
 #endif
@@ -13,13 +13,20 @@
         PRESERVE8
 
         EXTERN  RunPt            ; currently running thread
+        EXTERN  KernelBasePri    ; BASEPRI value of a kernel critical section
         EXPORT  StartOS
-        EXPORT  SysTick_Handler
+        EXPORT  PendSV_Handler
+        EXPORT  BasePriRaise
+        EXPORT  BasePriSet
         IMPORT  Scheduler
 
-
-SysTick_Handler                ; 1) Saves R0-R3,R12,LR,PC,PSR
-    CPSID   I                  ; 2) Prevent interrupt during switch
+; context switch, lowest priority so it runs after every other ISR
+; triggered by SysTick_Handler at the end of a time slice,
+; by OS_Suspend, or by OS_Signal waking a higher priority thread
+PendSV_Handler                 ; 1) Saves R0-R3,R12,LR,PC,PSR
+    LDR     R0, =KernelBasePri ; 2) Prevent kernel aware interrupts
+    LDR     R0, [R0]           ;    during switch, priority 0 still runs
+    MSR     BASEPRI, R0
     PUSH    {R4-R11}           ; 3) Save remaining regs r4-11
     LDR     R0, =RunPt         ; 4) R0=pointer to RunPt, old thread
     LDR     R1, [R0]           ;    R1 = RunPt
@@ -30,9 +37,28 @@ SysTick_Handler                ; 1) Saves R0-R3,R12,LR,PC,PSR
     LDR     R1, [R0]           ; 6) R1 = RunPt, new thread
     LDR     SP, [R1]           ; 7) new thread SP; SP = RunPt->sp;
     POP     {R4-R11}           ; 8) restore regs r4-11
-    CPSIE   I                  ; 9) tasks run with interrupts enabled
+    MOV     R2, #0             ; 9) tasks run with interrupts enabled
+    MSR     BASEPRI, R2
     BX      LR                 ; 10) restore R0-R3,R12,LR,PC,PSR
 
+; long BasePriRaise(uint32_t basepri)
+; start a kernel critical section, BASEPRI_MAX only ever
+; raises the masking level so nested sections are safe
+; Input: R0 new BASEPRI, priority<<5
+; Output: R0 old BASEPRI, to pass to BasePriSet
+BasePriRaise
+    MRS     R1, BASEPRI
+    MSR     BASEPRI_MAX, R0
+    MOV     R0, R1
+    BX      LR
+
+; void BasePriSet(long basepri)
+; end a kernel critical section
+; Input: R0 value returned by BasePriRaise
+BasePriSet
+    MSR     BASEPRI, R0
+    BX      LR
+
 StartOS
     LDR     R0, =RunPt         ; currently running thread
     LDR     R2, [R0]           ; R2 = value of RunPt
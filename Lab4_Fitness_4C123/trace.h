@@ -0,0 +1,41 @@
+// trace.h
+// Runs on LM4F120/TM4C123
+// Format of the kernel event trace recorded by os.c when TRACE is 1.
+// Also included by the host decoder in ../TraceDecoder, so it only
+// uses fixed size types and must stay the same on both sides.
+
+#ifndef __TRACE_H
+#define __TRACE_H  1
+
+#define TRACESIZE      512        // entries in the ring buffer, power of 2
+#define TRACEMAGIC     0x31435254 // "TRC1", TraceLog has been initialized
+#define TRACE_NOTHREAD 0xFF       // thread number when no thread is running
+#define TRACE_WORKER   0xFE       // thread number of the work queue thread
+
+// event codes; thread is the running thread unless noted,
+// semaphores are identified by bits 15-0 of their address
+#define TRACE_SWITCH   1  // thread switched in, arg = thread switched out
+#define TRACE_WAIT     2  // OS_Wait called, arg = semaphore
+#define TRACE_SIGNAL   3  // OS_Signal called, thread = thread woken up
+                          //   or TRACE_NOTHREAD, arg = semaphore
+#define TRACE_SLEEP    4  // OS_Sleep called, arg = ms (65535 if longer)
+#define TRACE_RELEASE  5  // periodic trigger due, arg = semaphore
+#define TRACE_ISRENTER 6  // interrupt started, arg = vector number
+#define TRACE_ISREXIT  7  // interrupt done, arg = vector number
+
+struct traceEntry {
+  uint32_t time;          // DWTCYCCNT, bus cycles
+  uint8_t event;          // TRACE_SWITCH to TRACE_ISREXIT
+  uint8_t thread;         // 0 for the first thread added
+  uint16_t arg;
+};
+
+struct traceLog {
+  uint32_t magic;         // TRACEMAGIC
+  uint32_t count;         // entries ever written, the newest is
+                          // entry[(count-1)%TRACESIZE]
+  uint32_t clockHz;       // bus clock, to turn cycles into time
+  struct traceEntry entry[TRACESIZE];
+};
+
+#endif
@@ -64,11 +64,12 @@ uint32_t LightData;           // 100 lux
 int32_t  TemperatureData;     // 0.1C
 uint8_t  TemperatureByteData; // 1C
 // semaphores
-int32_t NewData;  // true when new numbers to display on top of LCD
-int32_t LCDmutex; // exclusive access to LCD
-int32_t I2Cmutex; // exclusive access to I2C
+semaType NewData; // true when new numbers to display on top of LCD
+semaType LCDmutex; // exclusive access to LCD
+semaType I2Cmutex; // exclusive access to I2C
+semaType SendSteps; // Task5 asks Task7 to notify the phone of Steps
 int ReDrawAxes = 0;         // non-zero means redraw axes on next display task
-int Send0Flag=0;
+uint32_t StaleDisplay;      // number of times Task5 refreshed without new sound data
 
 enum plotstate{
   Accelerometer,
@@ -400,7 +401,9 @@ void Task5(void){int32_t soundSum; int count=0;
   BSP_LCD_DrawString(10, 1, "Sound=", TOPTXTCOLOR);
   OS_Signal(&LCDmutex);
   while(1){
-    OS_Wait(&NewData);
+    if(OS_WaitTimeout(&NewData, 1500) == 0){ // Task0 is late, refresh anyway
+      StaleDisplay = StaleDisplay + 1;
+    }
     TExaS_Task5();     // records system time in array, toggles virtual logic analyzer
 //    Profile_Toggle5(); // viewed by a real logic analyzer to know Task5 started
     soundSum = 0;
@@ -422,7 +425,7 @@ void Task5(void){int32_t soundSum; int count=0;
     OS_Signal(&LCDmutex);
     count++;
     if(count==5){
-      Send0Flag=1;
+      OS_Signal(&SendSteps);
       count=0;
     }
   }
@@ -460,10 +463,11 @@ void Task6(void){ uint32_t lightData;
 /*          End of Task6 Section              */
 /* ****************************************** */
 
-//---------------- Task7 dummy function ----------------
+//---------------- Task7 Bluetooth ----------------
 // *********Task7*********
 // Main thread scheduled by OS round robin preemptive scheduler
-// Task7 checks for Bluetooth incoming frames but never blocks or sleeps
+// Task7 checks for Bluetooth incoming frames every 10 ms, and
+// sends the Steps notification as soon as Task5 asks for it
 // Inputs:  none
 // Outputs: none
 uint32_t Count7;
@@ -472,11 +476,10 @@ void Task7(void){
   while(1){
     Count7++;
     AP_BackgroundProcess();
-    if(Send0Flag){
+    if(OS_WaitTimeout(&SendSteps, 10)){
+      while(OS_TryWait(&SendSteps)){}; // one notification if Task5 asked more than once
       AP_SendNotification(0);
-      Send0Flag=0;
     }
-    WaitForInterrupt();
   }
 }
 /* ****************************************** */
@@ -552,7 +555,7 @@ void Bluetooth_Init(void){volatile int r;
 // Task4  temperature    periodically every 1 sec
 // Task5  numbers on LCD after Task0 runs SOUNDRMSLENGTH times
 // Task6  light          periodically every 800 ms
-// Task7  dummy          no timing requirement
+// Task7  Bluetooth      every 10 ms, and when Task5 asks
 // Remember that you must have exactly one main() function, so
 // to work on this step, you must rename all other main()
 // functions in this file.
@@ -574,6 +577,7 @@ int main(void){
   OS_InitSemaphore(&NewData, 0);  // 0 means no data
   OS_InitSemaphore(&LCDmutex, 1); // 1 means free
   OS_InitSemaphore(&I2Cmutex, 1); // 1 means free
+  OS_InitSemaphore(&SendSteps, 0);
   OS_FIFO_Init();                 // initialize FIFO used to send data between Task1 and Task2
   // Task 0 should run every 1ms
   OS_AddPeriodicEventThread(&Task0, 1);
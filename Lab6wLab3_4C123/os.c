@@ -8,6 +8,7 @@
 #include "os.h"
 #include "CortexM.h"
 #include "BSP.h"
+#include "../inc/tm4c123gh6pm.h"
 
 // function definitions in osasm.s
 void StartOS(void);
@@ -15,31 +16,256 @@ void StartOS(void);
 #define NUMTHREADS  6        // maximum number of threads
 #define NUMPERIODIC 2        // maximum number of periodic threads
 #define STACKSIZE   100      // number of 32-bit words in stack per thread
+#define IDLE        NUMTHREADS // tcbs[IDLE] is the kernel's idle thread
+#define TICKLESS    1        // 1 stops the 1 ms interrupts while no thread is ready
+#define MAXIDLE     10000    // longest tickless idle time in ms
 #define NULL 0
 struct tcb {
   int32_t *sp;       // pointer to stack (valid for threads not running
   struct tcb *next;  // linked-list pointer
   // nonzero if blocked on this semaphore
-  int32_t *semaPt;
+  semaType *semaPt;
+  // next thread blocked on the same semaphore
+  struct tcb *nextBlocked;
   // nonzero if this thread is sleeping
   int32_t sleep;
+  // sleeping threads are sorted by wake up time, and each one
+  // stores the number of ms after the one before it (delta list)
+  struct tcb *nextSleep;
+  uint32_t delta;
+  // 1 if OS_WaitTimeout gave up before the semaphore was signaled
+  uint8_t timedOut;
 };
 
 typedef struct tcb tcbType;
-tcbType tcbs[NUMTHREADS];
+tcbType tcbs[NUMTHREADS+1];    // the idle thread is not in the ring
 tcbType *RunPt;
-int32_t Stacks[NUMTHREADS][STACKSIZE];
+int32_t Stacks[NUMTHREADS+1][STACKSIZE];
+tcbType *SleepPt;            // first thread to wake up, NULL if none sleeping
+
+// ******** SleepInsert ************
+// Put a thread into the sorted list of sleeping threads
+// Inputs:  thread to put to sleep
+//          number of msec to sleep, greater than zero
+// Outputs: none
+// Must be called with interrupts disabled
+void static SleepInsert(tcbType *thread, uint32_t sleepTime){
+  tcbType *prev = NULL;
+  tcbType *cur = SleepPt;
+  while (cur && cur->delta <= sleepTime) {  // after those that wake up first
+    sleepTime = sleepTime - cur->delta;
+    prev = cur;
+    cur = cur->nextSleep;
+  }
+  thread->delta = sleepTime;
+  thread->nextSleep = cur;
+  if (cur) {
+    cur->delta = cur->delta - sleepTime;    // cur now wakes up after thread
+  }
+  if (prev) {
+    prev->nextSleep = thread;
+  } else {
+    SleepPt = thread;
+  }
+}
+
+// ******** SleepRemove ************
+// Take a thread out of the sleeping list before its time is up
+// Inputs:  sleeping thread
+// Outputs: none
+// Must be called with interrupts disabled
+void static SleepRemove(tcbType *thread){
+  tcbType **pt = &SleepPt;
+  while (*pt != thread) {
+    pt = &(*pt)->nextSleep;
+  }
+  *pt = thread->nextSleep;
+  if (thread->nextSleep) {            // the next one waits for both deltas
+    thread->nextSleep->delta = thread->nextSleep->delta + thread->delta;
+  }
+  thread->sleep = 0;
+}
+
+// ******** SemaRemove ************
+// Take a thread out of the threads blocked on a semaphore and
+// give back the count it took, as if it had never waited
+// Inputs:  semaphore
+//          thread blocked on it
+// Outputs: none
+// Must be called with interrupts disabled
+void static SemaRemove(semaType *semaPt, tcbType *thread){
+  tcbType *prev = NULL;
+  tcbType **pt = &semaPt->head;
+  while (*pt != thread) {
+    prev = *pt;
+    pt = &(*pt)->nextBlocked;
+  }
+  *pt = thread->nextBlocked;
+  if (semaPt->tail == thread) {
+    semaPt->tail = prev;
+  }
+  semaPt->value = semaPt->value + 1;
+  thread->semaPt = NULL;
+}
 
 void static runperiodicevents(void){
 // ****IMPLEMENT THIS****
 // **RUN PERIODIC THREADS, DECREMENT SLEEP COUNTERS
-  tcbType *cur = RunPt;
-  do {
-    if (cur->sleep) {
-      cur->sleep--;
+  tcbType *cur;
+  long sr = StartCritical();
+  // only the first sleeping thread is counted down,
+  // the others are stored relative to it
+  if (SleepPt) {
+    SleepPt->delta--;
+    while (SleepPt && SleepPt->delta == 0) {
+      cur = SleepPt;          // done sleeping
+      SleepPt = cur->nextSleep;
+      cur->sleep = 0;
+      if (cur->semaPt) {      // OS_WaitTimeout gives up
+        SemaRemove(cur->semaPt, cur);
+        cur->timedOut = 1;
+      }
     }
-    cur = cur->next;
-  } while (cur != RunPt);
+  }
+  EndCritical(sr);
+}
+
+// periodic event threads, all run from one 1 ms interrupt
+struct event {
+  void(*thread)(void);       // event thread to run
+  uint32_t period;           // ms between runs
+  uint32_t left;             // ms until the next run
+};
+struct event Events[NUMPERIODIC];
+int32_t NumEvents;           // number of periodic event threads added
+
+void static runperiodicthreads(void){
+  int i;
+  for (i = 0; i < NumEvents; i++) {
+    Events[i].left--;
+    if (Events[i].left == 0) {
+      Events[i].left = Events[i].period;
+      Events[i].thread();
+    }
+  }
+}
+
+#if TICKLESS
+uint32_t TickCycles;         // bus cycles in one 1 ms tick
+uint32_t SkippedTicks;       // number of 1 ms interrupts not taken while idle
+
+// ******** TickStretch ************
+// Delay the next timeout of a 1 ms periodic wide timer so it
+// interrupts after ticks ms instead; it goes back to 1 ms
+// on its own because the reload value is not changed
+// Inputs:  the timer's TAV register
+//          number of ms until the next interrupt, at least 2
+// Outputs: none
+// Must be called with interrupts disabled
+void static TickStretch(volatile uint32_t *tav, uint32_t ticks){
+  *tav = *tav + (ticks-1)*TickCycles;
+}
+
+// ******** TickResume ************
+// Put a timer delayed by TickStretch back on its 1 ms period,
+// keeping the same phase
+// Inputs:  the timer's TAV and RIS registers
+//          number of ms given to TickStretch
+// Outputs: number of 1 ms ticks that passed without an interrupt
+// Must be called with interrupts disabled
+uint32_t static TickResume(volatile uint32_t *tav, volatile uint32_t *ris, uint32_t ticks){
+  uint32_t left,remaining;
+  left = *tav;                       // cycles until the delayed timeout
+  if (((*ris)&TIMER_RIS_TATORIS) || (left == 0)) {
+    return ticks-1;                  // timed out, ISR handles the last tick
+  }
+  remaining = (left+TickCycles-1)/TickCycles; // ticks not reached yet
+  *tav = left - (remaining-1)*TickCycles;     // time to the next tick
+  return ticks-remaining;
+}
+
+// ******** NextEvent ************
+// Find when the next periodic event thread must run
+// Inputs:  none
+// Outputs: number of ms until then, at most MAXIDLE,
+//          0 if there are no periodic event threads
+// Must be called with interrupts disabled
+uint32_t static NextEvent(void){
+  uint32_t ticks = 0;
+  int i;
+  for (i = 0; i < NumEvents; i++) {
+    if ((ticks == 0) || (Events[i].left < ticks)) {
+      ticks = Events[i].left;
+    }
+  }
+  if (ticks > MAXIDLE) {
+    return MAXIDLE;
+  }
+  return ticks;
+}
+
+// ******** EventSkip ************
+// Count 1 ms ticks that passed without running runperiodicthreads
+// Inputs:  number of ticks, less than NextEvent()
+// Outputs: none
+// Must be called with interrupts disabled
+void static EventSkip(uint32_t ticks){
+  int i;
+  for (i = 0; i < NumEvents; i++) {
+    Events[i].left = Events[i].left - ticks;
+  }
+}
+#endif
+
+// ******** IdleWait ************
+// Called by the idle thread when every thread is blocked or sleeping
+// Sleeps until an interrupt is pending. In tickless mode the
+// SysTick time slice is stopped, and the 1 ms sleep and periodic
+// event timers interrupt only when the first sleeping thread must
+// wake up or the next periodic event thread must run
+// Inputs:  none
+// Outputs: none
+// Must be called with interrupts disabled, the pending ISR runs
+// when interrupts are enabled again
+void static IdleWait(void){
+#if TICKLESS
+  uint32_t sleepTicks,eventTicks,skipped;
+  eventTicks = NextEvent();          // 0 if WideTimer3 is not used
+  if ((WTIMER4_RIS_R&TIMER_RIS_TATORIS) ||
+      (eventTicks && (WTIMER3_RIS_R&TIMER_RIS_TATORIS))) {
+    return;                          // a tick is already pending
+  }
+  sleepTicks = MAXIDLE;
+  if (SleepPt && (SleepPt->delta < MAXIDLE)) {
+    sleepTicks = SleepPt->delta;
+  }
+  if ((sleepTicks < 2) && (eventTicks < 2)) {
+    WaitForInterrupt();              // next tick is needed anyway
+    return;
+  }
+  STCTRL = 0;                        // no time slices while idle
+  if (sleepTicks >= 2) {
+    TickStretch(&WTIMER4_TAV_R, sleepTicks);
+  }
+  if (eventTicks >= 2) {
+    TickStretch(&WTIMER3_TAV_R, eventTicks);
+  }
+  WaitForInterrupt();                // any interrupt wakes up
+  if (sleepTicks >= 2) {
+    skipped = TickResume(&WTIMER4_TAV_R, &WTIMER4_RIS_R, sleepTicks);
+    if (SleepPt) {
+      SleepPt->delta = SleepPt->delta - skipped;
+    }
+    SkippedTicks = SkippedTicks + skipped;
+  }
+  if (eventTicks >= 2) {
+    EventSkip(TickResume(&WTIMER3_TAV_R, &WTIMER3_RIS_R, eventTicks));
+  }
+  STCURRENT = 0;                     // next thread gets a full time slice
+  STCTRL = 0x00000007;
+#else
+  WaitForInterrupt();                // wakes up even with interrupts disabled
+#endif
 }
 
 // ******** OS_Init ************
@@ -54,6 +280,9 @@ void OS_Init(void){
   // perform any initializations needed
   // init runperiodicevents
   BSP_PeriodicTask_InitB(&runperiodicevents, 1000, 5);
+#if TICKLESS
+  TickCycles = BSP_Clock_GetFreq()/1000;
+#endif
 }
 
 void SetInitialStack(int i){
@@ -76,6 +305,33 @@ void SetInitialStack(int i){
   Stacks[i][STACKSIZE-16] = 0x04040404;  // R4
 }
 
+// ******** Idle ************
+// The kernel's idle thread, runs only when every thread in the
+// ring is blocked or sleeping. An ISR may signal or wake a thread
+// after the switch, so it looks again with interrupts disabled
+// before it sleeps
+// Inputs:  none
+// Outputs: none (never returns)
+void static Idle(void){
+  tcbType *pt;
+  int i;
+  while(1){
+    DisableInterrupts();
+    pt = tcbs[IDLE].next;  // same ring walk as the scheduler
+    for (i = 0; i < NUMTHREADS; i++) {
+      if ((pt->semaPt == NULL) && (pt->sleep == 0)) {
+        break;            // an ISR made a thread ready since the last switch
+      }
+      pt = pt->next;
+    }
+    if (i == NUMTHREADS) {
+      IdleWait();
+    }
+    EnableInterrupts();   // let the ISR signal or wake a thread
+    OS_Suspend();         // run it now, not at the next time slice
+  }
+}
+
 //******** OS_AddThreads ***************
 // Add six main threads to the scheduler
 // Inputs: function pointers to six void/void main threads
@@ -106,6 +362,7 @@ int OS_AddThreads(void(*thread0)(void),
   tcbs[3].sleep = 0;
   tcbs[4].sleep = 0;
   tcbs[5].sleep = 0;
+  SleepPt = NULL;
 
   // initialize threads to be not blocking
   tcbs[0].semaPt = NULL;
@@ -134,6 +391,13 @@ int OS_AddThreads(void(*thread0)(void),
   SetInitialStack(5);
   Stacks[5][STACKSIZE-2] = (int32_t)(thread5); // PC
 
+  // the idle thread, never blocked or sleeping
+  tcbs[IDLE].next = &tcbs[0];
+  tcbs[IDLE].sleep = 0;
+  tcbs[IDLE].semaPt = NULL;
+  SetInitialStack(IDLE);
+  Stacks[IDLE][STACKSIZE-2] = (int32_t)(&Idle); // PC
+
   // initialize RunPt
   RunPt = &tcbs[0];       // thread 0 will run first
 
@@ -152,20 +416,23 @@ int OS_AddThreads(void(*thread0)(void),
 // These threads cannot spin, block, loop, sleep, or kill
 // These threads can call OS_Signal
 // In Lab 3 this will be called exactly twice
-
-static int32_t numPeriodic = 0;
+// All of them run from one 1 ms interrupt on Wide Timer 3A, so the
+// idle thread can stretch it up to the next one that is due
 int OS_AddPeriodicEventThread(void(*thread)(void), uint32_t period){
-  double freq = (1 / (double) period) * 1000;
-  int32_t castedFreq = (int32_t) freq;
-
-  if (numPeriodic == 0) {
-    numPeriodic++;
-    BSP_PeriodicTask_InitC(thread, castedFreq, 3);
-    return 1;
-  } else {
-    BSP_PeriodicTask_Init(thread, castedFreq, 3);
-    return 1;
+  long sr;
+  if ((period == 0) || (NumEvents >= NUMPERIODIC)) {
+    return 0;
+  }
+  sr = StartCritical();
+  Events[NumEvents].thread = thread;
+  Events[NumEvents].period = period;
+  Events[NumEvents].left = period;   // first run one period from now
+  NumEvents++;
+  if (NumEvents == 1) {
+    BSP_PeriodicTask_InitC(&runperiodicthreads, 1000, 3);
   }
+  EndCritical(sr);
+  return 1;
 }
 
 
@@ -186,10 +453,20 @@ void OS_Launch(uint32_t theTimeSlice){
 // runs every ms
 void Scheduler(void){ // every time slice
 // ROUND ROBIN, skip blocked and sleeping threads
-  RunPt = RunPt->next;
-	while (RunPt->semaPt || RunPt->sleep) {
-		RunPt = RunPt->next;
-	}
+  tcbType *pt = RunPt->next;  // the idle thread's next is where to go on
+  int i;
+  for (i = 0; i < NUMTHREADS; i++) {
+    if ((pt->semaPt == NULL) && (pt->sleep == 0)) {
+      RunPt = pt;
+      return;
+    }
+    pt = pt->next;
+  }
+  // went around, every thread blocked or sleeping
+  if (RunPt != &tcbs[IDLE]) {
+    tcbs[IDLE].next = RunPt->next;
+  }
+  RunPt = &tcbs[IDLE];
 }
 
 //******** OS_Suspend ***************
@@ -209,8 +486,13 @@ void OS_Suspend(void){
 // output: none
 // OS_Sleep(0) implements cooperative multitasking
 void OS_Sleep(uint32_t sleepTime){
+  DisableInterrupts();
 // set sleep parameter in TCB
   RunPt->sleep = sleepTime;
+  if (sleepTime) {
+    SleepInsert(RunPt, sleepTime);
+  }
+  EnableInterrupts();
 // suspend, stops running
   OS_Suspend();
 }
@@ -220,9 +502,11 @@ void OS_Sleep(uint32_t sleepTime){
 // Inputs:  pointer to a semaphore
 //          initial value of semaphore
 // Outputs: none
-void OS_InitSemaphore(int32_t *semaPt, int32_t value){
+void OS_InitSemaphore(semaType *semaPt, int32_t value){
 //***IMPLEMENT THIS***
-  (*semaPt) = value;
+  semaPt->value = value;
+  semaPt->head = NULL;   // no threads blocked
+  semaPt->tail = NULL;
 }
 
 // ******** OS_Wait ************
@@ -231,14 +515,22 @@ void OS_InitSemaphore(int32_t *semaPt, int32_t value){
 // Lab3 block if less than zero
 // Inputs:  pointer to a counting semaphore
 // Outputs: none
-void OS_Wait(int32_t *semaPt){
+void OS_Wait(semaType *semaPt){
 //***IMPLEMENT THIS***
   DisableInterrupts();
 
-  (*semaPt) = (*semaPt) - 1;
+  semaPt->value = semaPt->value - 1;
 
-  if ((*semaPt) < 0) {
+  if (semaPt->value < 0) {
     RunPt->semaPt = semaPt;
+    // add to the end of the FIFO of blocked threads
+    RunPt->nextBlocked = NULL;
+    if (semaPt->head == NULL) {
+      semaPt->head = RunPt;
+    } else {
+      semaPt->tail->nextBlocked = RunPt;
+    }
+    semaPt->tail = RunPt;
     EnableInterrupts();
     OS_Suspend();
   }
@@ -246,24 +538,75 @@ void OS_Wait(int32_t *semaPt){
   EnableInterrupts();
 }
 
+// ******** OS_WaitTimeout ************
+// Decrement semaphore, blocking for at most timeout ms if
+// less than zero; whichever comes first, OS_Signal or the
+// timeout, makes the thread ready again
+// Inputs:  pointer to a counting semaphore
+//          number of msec to wait, 0 to never block (OS_TryWait)
+// Outputs: 1 if the semaphore was taken, 0 if the time ran out
+int OS_WaitTimeout(semaType *semaPt, uint32_t timeout){
+  if (timeout == 0) {
+    return OS_TryWait(semaPt);
+  }
+  DisableInterrupts();
+  semaPt->value = semaPt->value - 1;
+  if (semaPt->value >= 0) {
+    EnableInterrupts();
+    return 1;
+  }
+  RunPt->semaPt = semaPt;
+  RunPt->nextBlocked = NULL;
+  if (semaPt->head == NULL) {
+    semaPt->head = RunPt;
+  } else {
+    semaPt->tail->nextBlocked = RunPt;
+  }
+  semaPt->tail = RunPt;
+  RunPt->timedOut = 0;
+  RunPt->sleep = timeout;      // also on the sleeping list
+  SleepInsert(RunPt, timeout);
+  EnableInterrupts();
+  OS_Suspend();                // OS_Signal or runperiodicevents wakes it
+  return RunPt->timedOut == 0;
+}
+
+// ******** OS_TryWait ************
+// Decrement a semaphore only if that does not block
+// Inputs:  pointer to a counting semaphore
+// Outputs: 1 if decremented, 0 if it was not positive
+// Can be called from an event thread
+int OS_TryWait(semaType *semaPt){
+  int ok = 0;
+  long sr = StartCritical();
+  if (semaPt->value > 0) {   // positive means no thread is blocked
+    semaPt->value = semaPt->value - 1;
+    ok = 1;
+  }
+  EndCritical(sr);
+  return ok;
+}
+
 // ******** OS_Signal ************
 // Increment semaphore
 // Lab2 spinlock
 // Lab3 wakeup blocked thread if appropriate
 // Inputs:  pointer to a counting semaphore
 // Outputs: none
-void OS_Signal(int32_t *semaPt){
+void OS_Signal(semaType *semaPt){
 //***IMPLEMENT THIS***
+  tcbType *cur;
   DisableInterrupts();
-	tcbType *cur;
-  (*semaPt) = (*semaPt) + 1;
+  semaPt->value = semaPt->value + 1;
 
-  if ((*semaPt <= 0)) {
-		cur = RunPt->next;
-		while (cur->semaPt != semaPt) {
-			cur = cur->next;
-		}
-		cur->semaPt = NULL;
+  if (semaPt->value <= 0) {
+    // wake up the thread that has been blocked the longest
+    cur = semaPt->head;
+    semaPt->head = cur->nextBlocked;
+    cur->semaPt = NULL;
+    if (cur->sleep) {
+      SleepRemove(cur);     // in OS_WaitTimeout, signaled in time
+    }
   }
   EnableInterrupts();
 }
@@ -272,7 +615,7 @@ void OS_Signal(int32_t *semaPt){
 uint32_t PutI;      // index of where to put next
 uint32_t GetI;      // index of where to get next
 uint32_t Fifo[FSIZE];
-int32_t CurrentSize;// 0 means FIFO empty, FSIZE means full
+semaType CurrentSize;// 0 means FIFO empty, FSIZE means full
 uint32_t LostData;  // number of lost pieces of data
 
 // ******** OS_FIFO_Init ************
@@ -297,7 +640,7 @@ void OS_FIFO_Init(void){
 // Inputs:  data to be stored
 // Outputs: 0 if successful, -1 if the FIFO is full
 int OS_FIFO_Put(uint32_t data){
-  if (CurrentSize == FSIZE) {
+  if (CurrentSize.value == FSIZE) {
     LostData++;
     return -1; // queue is full
   }
@@ -0,0 +1,283 @@
+// tracedump.c
+// Runs on Linux (or any host with a C99 compiler)
+// Turns a kernel event trace saved from the TM4C123 into a
+// Chrome trace (JSON) file, which chrome://tracing and
+// https://ui.perfetto.dev show as a timeline with one row per
+// thread and per interrupt. Also prints the wake up latency of
+// each thread, from the OS_Signal that made it ready until it
+// was switched in.
+//
+// Build:   gcc -std=c99 -O2 -o tracedump tracedump.c
+// Record:  set TRACE to 1 in Lab4_Fitness_4C123/os.c, run, halt,
+//          then in the uVision debugger command window
+//            SAVE trace.hex start, start+4107
+//          where start is the address of TraceLog (Watch window or
+//          the .map file) and 4107 is sizeof(struct traceLog)-1
+// Decode:  ./tracedump trace.hex > trace.json
+// The input can be the Intel HEX file from SAVE, or a raw binary
+// copy of TraceLog, e.g. from a GDB "dump binary value" command.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Lab4_Fitness_4C123/trace.h"
+
+#define NUMIDS    256        // thread numbers 0 to 253, TRACE_WORKER and TRACE_NOTHREAD
+#define ISRTID    1000       // timeline row of vector v is ISRTID+v
+#define IDLETID   TRACE_NOTHREAD
+
+struct traceLog Log;
+
+// ------------HexDigits------------
+// Value of a field of hexadecimal digits
+// Input: first digit, number of digits
+// Output: value, or -1 if a character is not a hex digit
+long HexDigits(const char *pt, int n){
+  long value = 0;
+  int i;
+  for(i=0; i<n; i++){
+    char c = pt[i];
+    value = value*16;
+    if((c >= '0')&&(c <= '9')){
+      value = value+c-'0';
+    } else if((c >= 'A')&&(c <= 'F')){
+      value = value+c-'A'+10;
+    } else if((c >= 'a')&&(c <= 'f')){
+      value = value+c-'a'+10;
+    } else{
+      return -1;
+    }
+  }
+  return value;
+}
+
+// ------------ReadHex------------
+// Copy the data records of an Intel HEX file into Log, the
+// first data byte in the file goes to the start of Log
+// Input: open file
+// Output: number of bytes stored, -1 if the file is not valid
+long ReadHex(FILE *in){
+  char line[600];
+  uint32_t upper = 0;        // from type 02 and 04 records
+  uint32_t base = 0;
+  int haveBase = 0;
+  long size = 0;
+  while(fgets(line, sizeof(line), in)){
+    long count,addr,type,i;
+    uint32_t where;
+    if(line[0] != ':'){
+      continue;
+    }
+    count = HexDigits(&line[1], 2);
+    addr = HexDigits(&line[3], 4);
+    type = HexDigits(&line[7], 2);
+    if((count < 0)||(addr < 0)||(type < 0)||((long)strlen(line) < 11+2*count)){
+      return -1;
+    }
+    if(type == 1){           // end of file
+      break;
+    }
+    if(type == 2){           // extended segment address
+      upper = (uint32_t)HexDigits(&line[9], 4)<<4;
+      continue;
+    }
+    if(type == 4){           // extended linear address
+      upper = (uint32_t)HexDigits(&line[9], 4)<<16;
+      continue;
+    }
+    if(type != 0){
+      continue;
+    }
+    where = upper+(uint32_t)addr;
+    if(!haveBase){
+      base = where;
+      haveBase = 1;
+    }
+    for(i=0; i<count; i++){
+      long byte = HexDigits(&line[9+2*i], 2);
+      uint32_t offset = where-base+(uint32_t)i;
+      if(byte < 0){
+        return -1;
+      }
+      if(offset < sizeof(Log)){
+        ((uint8_t *)&Log)[offset] = (uint8_t)byte;
+        if((long)offset+1 > size){
+          size = offset+1;
+        }
+      }
+    }
+  }
+  return size;
+}
+
+int First = 1;               // no JSON event written yet
+// ------------Event------------
+// Write the start of one trace event object, the caller adds
+// any "args" and the closing brace
+// Input: phase ("B", "E", "i" or "M"), name, row, time in us
+// Output: none
+void Event(const char *ph, const char *name, int tid, double us){
+  printf("%s\n{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f",
+         First ? "" : ",", ph, name, tid, us);
+  First = 0;
+}
+
+int main(int argc, char **argv){
+  FILE *in;
+  long size;
+  uint32_t n,i,start;
+  uint64_t cycles = 0;       // time since the oldest entry, wrap around removed
+  uint32_t last = 0;
+  double perUs;
+  int running = -1;          // row of the thread running now, -1 unknown
+  int open[NUMIDS];          // 1 if a "run" slice is open on this row
+  int isrOpen[256];          // depth of open slices of each vector
+  int isrSeen[256];
+  int seen[NUMIDS];
+  int wakeSet[NUMIDS];
+  uint64_t wakeTime[NUMIDS]; // cycles when each thread was made ready
+  uint32_t wakeups[NUMIDS];
+  uint64_t latencySum[NUMIDS],latencyMax[NUMIDS];
+
+  if(argc != 2){
+    fprintf(stderr, "usage: %s trace.hex|trace.bin > trace.json\n", argv[0]);
+    return 1;
+  }
+  in = fopen(argv[1], "rb");
+  if(in == NULL){
+    perror(argv[1]);
+    return 1;
+  }
+  if(fgetc(in) == ':'){
+    rewind(in);
+    size = ReadHex(in);
+  } else{
+    rewind(in);
+    size = (long)fread(&Log, 1, sizeof(Log), in);
+  }
+  fclose(in);
+  if((size < (long)sizeof(Log))||(Log.magic != TRACEMAGIC)){
+    fprintf(stderr, "%s: not a complete TraceLog (%ld of %ld bytes)\n",
+            argv[1], size, (long)sizeof(Log));
+    return 1;
+  }
+  perUs = Log.clockHz/1000000.0;
+  if(perUs <= 0){
+    perUs = 80.0;            // BSP_Clock_InitFastest
+  }
+  n = (Log.count < TRACESIZE) ? Log.count : TRACESIZE;
+  start = Log.count-n;       // oldest entry still in the ring
+  memset(open, 0, sizeof(open));
+  memset(isrOpen, 0, sizeof(isrOpen));
+  memset(isrSeen, 0, sizeof(isrSeen));
+  memset(seen, 0, sizeof(seen));
+  memset(wakeSet, 0, sizeof(wakeSet));
+  memset(wakeups, 0, sizeof(wakeups));
+  memset(latencySum, 0, sizeof(latencySum));
+  memset(latencyMax, 0, sizeof(latencyMax));
+
+  printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for(i=0; i<n; i++){
+    struct traceEntry *e = &Log.entry[(start+i)&(TRACESIZE-1)];
+    double us;
+    if(i > 0){               // entries are less than 53 s apart at 80 MHz
+      cycles = cycles+(int64_t)(int32_t)(e->time-last);
+    }
+    last = e->time;
+    us = cycles/perUs;
+    switch(e->event){
+      case TRACE_SWITCH:
+        if((e->arg < NUMIDS)&&open[e->arg]){
+          Event("E", e->arg == IDLETID ? "idle" : "run", e->arg, us);
+          printf("}");
+          open[e->arg] = 0;
+        }
+        Event("B", e->thread == IDLETID ? "idle" : "run", e->thread, us);
+        printf("}");
+        open[e->thread] = 1;
+        seen[e->thread] = 1;
+        running = e->thread;
+        if(wakeSet[e->thread]){
+          uint64_t latency = cycles-wakeTime[e->thread];
+          wakeups[e->thread]++;
+          latencySum[e->thread] += latency;
+          if(latency > latencyMax[e->thread]){
+            latencyMax[e->thread] = latency;
+          }
+          wakeSet[e->thread] = 0;
+        }
+        break;
+      case TRACE_WAIT:
+      case TRACE_SLEEP:
+        Event("i", e->event == TRACE_WAIT ? "OS_Wait" : "OS_Sleep", e->thread, us);
+        seen[e->thread] = 1;
+        if(e->event == TRACE_WAIT){
+          printf(",\"s\":\"t\",\"args\":{\"sema\":\"0x%04x\"}}", e->arg);
+        } else{
+          printf(",\"s\":\"t\",\"args\":{\"ms\":%u}}", e->arg);
+        }
+        break;
+      case TRACE_SIGNAL:
+      case TRACE_RELEASE:
+        Event("i", e->event == TRACE_SIGNAL ? "OS_Signal" : "release",
+              running >= 0 ? running : IDLETID, us);
+        printf(",\"s\":\"t\",\"args\":{\"sema\":\"0x%04x\"", e->arg);
+        if((e->event == TRACE_SIGNAL)&&(e->thread != TRACE_NOTHREAD)){
+          printf(",\"woke\":%u", e->thread);
+          if(!wakeSet[e->thread]){
+            wakeSet[e->thread] = 1;
+            wakeTime[e->thread] = cycles;
+          }
+        }
+        printf("}}");
+        break;
+      case TRACE_ISRENTER:
+      case TRACE_ISREXIT:
+        if(e->arg >= 256){
+          break;
+        }
+        if(e->event == TRACE_ISRENTER){
+          isrOpen[e->arg]++;
+        } else if(isrOpen[e->arg] > 0){
+          isrOpen[e->arg]--;
+        } else{
+          break;             // entered before the oldest entry
+        }
+        Event(e->event == TRACE_ISRENTER ? "B" : "E", "ISR", ISRTID+e->arg, us);
+        printf(",\"args\":{\"vector\":%u}}", e->arg);
+        isrSeen[e->arg] = 1;
+        break;
+      default:
+        break;
+    }
+  }
+  for(i=0; i<NUMIDS; i++){   // name the thread rows
+    if(seen[i]){
+      Event("M", "thread_name", i, 0);
+      if(i == IDLETID){
+        printf(",\"args\":{\"name\":\"idle\"}}");
+      } else if(i == TRACE_WORKER){
+        printf(",\"args\":{\"name\":\"work queue\"}}");
+      } else{
+        printf(",\"args\":{\"name\":\"thread %u\"}}", i);
+      }
+    }
+  }
+  for(i=0; i<256; i++){
+    if(isrSeen[i]){
+      Event("M", "thread_name", ISRTID+i, 0);
+      printf(",\"args\":{\"name\":\"ISR vector %u\"}}", i);
+    }
+  }
+  printf("\n]}\n");
+
+  fprintf(stderr, "%u events, %.3f ms\n", n, cycles/perUs/1000.0);
+  for(i=0; i<NUMIDS; i++){
+    if(wakeups[i]){
+      fprintf(stderr, "thread %u: %u wake ups, latency avg %.2f us, max %.2f us\n",
+              i, wakeups[i], latencySum[i]/perUs/wakeups[i], latencyMax[i]/perUs);
+    }
+  }
+  return 0;
+}
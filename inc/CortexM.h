@@ -15,6 +15,9 @@
 #define HFAULTSTAT      (*((volatile uint32_t *)0xE000ED2C))
 #define MMADDR          (*((volatile uint32_t *)0xE000ED34))
 #define FAULTADDR       (*((volatile uint32_t *)0xE000ED38))
+#define DEMCR           (*((volatile uint32_t *)0xE000EDFC))
+#define DWTCTRL         (*((volatile uint32_t *)0xE0001000))
+#define DWTCYCCNT       (*((volatile uint32_t *)0xE0001004))
 
 // these functions are defined in the startup file
 